@@ -0,0 +1,293 @@
+#include "art.h"
+#include "frozen.h"
+#include "table.h"
+#include "tree.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Table against the radix tree on real paths: a scanned directory tree, or a
+ * list with one path per line. Reports memory, lookup and miss times, and the
+ * cost of listing everything under a directory, which Table can only do by
+ * going through every slot. A frozen copy of the Table is measured too,
+ * without prefixes.
+ */
+
+#define DEFAULT_ROOT "/usr"
+#define N_QUERIES 200
+#define MISS_SUFFIX "~"
+
+/* Keeps the lookups from being optimised out */
+static volatile uintptr_t sink;
+
+struct Paths {
+	size_t n;
+	size_t cap;
+	char **paths;
+	unsigned char *is_dir;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static int
+paths_add(struct Paths *p, const char *path, int is_dir)
+{
+	if (p->n == p->cap) {
+		const size_t cap = p->cap ? 2 * p->cap : 1024;
+		char **paths = realloc(p->paths, cap * sizeof(*paths));
+		unsigned char *dirs;
+
+		if (!paths)
+			return -1;
+		p->paths = paths;
+		dirs = realloc(p->is_dir, cap);
+		if (!dirs)
+			return -1;
+		p->is_dir = dirs;
+		p->cap = cap;
+	}
+	p->paths[p->n] = strdup(path);
+	if (!p->paths[p->n])
+		return -1;
+	p->is_dir[p->n++] = (unsigned char)is_dir;
+	return 0;
+}
+
+static int
+paths_scan(struct Paths *p, const char *root)
+{
+	struct Manifest man;
+
+	if (tree_scan(root, &man))
+		return -1;
+	/* entries[0] is the root itself */
+	for (size_t i = 1; i < man.n_entries; i++)
+		if (paths_add(
+				p,
+				manifest_path(&man, man.entries + i),
+				man.entries[i].type == tree_dir
+			))
+			return -1;
+	manifest_destroy(&man);
+	return 0;
+}
+
+/* One path per line, lines ending in / count as directories */
+static int
+paths_read(struct Paths *p, const char *file)
+{
+	FILE *f = fopen(file, "r");
+	char line[4096];
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		size_t len = strcspn(line, "\n");
+		int is_dir = 0;
+
+		line[len] = '\0';
+		if (len > 1 && line[len - 1] == '/') {
+			line[--len] = '\0';
+			is_dir = 1;
+		}
+		if (len && paths_add(p, line, is_dir)) {
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+static int
+count_key(const char *key, void *val, void *ctx)
+{
+	(*(size_t *)ctx)++;
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct Paths p = {0};
+	struct Table tbl;
+	struct Art art;
+	struct FrozenTable frozen;
+	void *val;
+	size_t key_bytes = 0, tbl_bytes, found = 0;
+	uint64_t seed = 0x9e3779b97f4a7c15;
+	size_t *order, *dirs, n_dirs = 0;
+	char (*misses)[4096];
+	double t;
+
+	if (argc == 1 && paths_scan(&p, DEFAULT_ROOT)) {
+		perror(DEFAULT_ROOT);
+		return 1;
+	}
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			if (paths_read(&p, argv[++i])) {
+				perror(argv[i]);
+				return 1;
+			}
+		} else if (argv[i][0] == '-' || paths_scan(&p, argv[i])) {
+			fprintf(stderr, "usage: %s [<dir> | -f <list>]...\n", argv[0]);
+			return 1;
+		}
+	}
+	if (!p.n) {
+		fprintf(stderr, "no paths\n");
+		return 1;
+	}
+
+	order = malloc(p.n * sizeof(*order));
+	dirs = malloc(p.n * sizeof(*dirs));
+	misses = malloc(N_QUERIES * sizeof(*misses));
+	if (!order || !dirs || !misses || table_init(&tbl) || art_init(&art)) {
+		perror("setup");
+		return 1;
+	}
+	for (size_t i = 0; i < p.n; i++) {
+		key_bytes += strlen(p.paths[i]) + 1;
+		order[i] = xorshift(&seed) % p.n;
+		if (p.is_dir[i])
+			dirs[n_dirs++] = i;
+		if (table_insert(&tbl, p.paths[i], (void *)(uintptr_t)(i + 1)) ||
+		    art_insert(&art, p.paths[i], (void *)(uintptr_t)(i + 1))) {
+			perror("insert");
+			return 1;
+		}
+	}
+	tbl_bytes = tbl.n_slots * sizeof(*tbl.slots) + key_bytes;
+
+	printf(
+		"%zu paths (%zu directories), %.1f bytes/key of key text\n",
+		p.n,
+		n_dirs,
+		(double)key_bytes / (double)p.n
+	);
+	printf(
+		"%-6s %12s %9s %9s %9s %12s\n",
+		"index",
+		"bytes",
+		"B/key",
+		"find ns",
+		"miss ns",
+		"prefix us"
+	);
+
+	/* Table */
+	t = now();
+	for (size_t i = 0; i < p.n; i++)
+		sink += (uintptr_t)*table_find(&tbl, p.paths[order[i]]);
+	printf(
+		"%-6s %12zu %9.1f %9.1f",
+		"table",
+		tbl_bytes,
+		(double)tbl_bytes / (double)p.n,
+		(now() - t) * 1e9 / (double)p.n
+	);
+	for (size_t i = 0; i < N_QUERIES; i++)
+		snprintf(
+			misses[i],
+			sizeof(*misses),
+			"%s" MISS_SUFFIX,
+			p.paths[order[i]]
+		);
+	t = now();
+	for (size_t i = 0; i < N_QUERIES; i++)
+		sink += table_find(&tbl, misses[i]) != NULL;
+	printf(" %9.1f", (now() - t) * 1e9 / N_QUERIES);
+	t = now();
+	for (size_t i = 0; i < N_QUERIES && n_dirs; i++) {
+		const char *dir = p.paths[dirs[order[i] % n_dirs]];
+		const size_t len = strlen(dir);
+		const char *key;
+		size_t pos = 0;
+
+		while (table_next(&tbl, &pos, &key, &val))
+			if (!strncmp(key, dir, len) && key[len] == '/')
+				found++;
+	}
+	printf(" %12.1f\n", (now() - t) * 1e6 / N_QUERIES);
+	sink += found;
+
+	/* Radix tree */
+	t = now();
+	for (size_t i = 0; i < p.n; i++)
+		sink += (uintptr_t)*art_find(&art, p.paths[order[i]]);
+	printf(
+		"%-6s %12zu %9.1f %9.1f",
+		"art",
+		art.n_bytes,
+		(double)art.n_bytes / (double)p.n,
+		(now() - t) * 1e9 / (double)p.n
+	);
+	t = now();
+	for (size_t i = 0; i < N_QUERIES; i++)
+		sink += art_find(&art, misses[i]) != NULL;
+	printf(" %9.1f", (now() - t) * 1e9 / N_QUERIES);
+	found = 0;
+	t = now();
+	for (size_t i = 0; i < N_QUERIES && n_dirs; i++) {
+		char dir[4096];
+
+		snprintf(dir, sizeof(dir), "%s/", p.paths[dirs[order[i] % n_dirs]]);
+		art_prefix(&art, dir, count_key, &found);
+	}
+	printf(" %12.1f\n", (now() - t) * 1e6 / N_QUERIES);
+	sink += found;
+
+	/* Frozen table */
+	if (table_freeze(&tbl, &frozen)) {
+		perror("freeze");
+		return 1;
+	}
+	t = now();
+	for (size_t i = 0; i < p.n; i++)
+		if (!frozen_find(&frozen, p.paths[order[i]], &val))
+			sink += (uintptr_t)val;
+	printf(
+		"%-6s %12zu %9.1f %9.1f",
+		"frozen",
+		frozen.map_len,
+		(double)frozen.map_len / (double)p.n,
+		(now() - t) * 1e9 / (double)p.n
+	);
+	t = now();
+	for (size_t i = 0; i < N_QUERIES; i++)
+		sink += !frozen_find(&frozen, misses[i], &val);
+	printf(" %9.1f %12s\n", (now() - t) * 1e9 / N_QUERIES, "-");
+
+	frozen_destroy(&frozen);
+	art_destroy(&art);
+	table_destroy(&tbl);
+	for (size_t i = 0; i < p.n; i++)
+		free(p.paths[i]);
+	free(p.paths);
+	free(p.is_dir);
+	free(misses);
+	free(dirs);
+	free(order);
+	return 0;
+}
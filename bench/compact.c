@@ -0,0 +1,303 @@
+#include "compact.h"
+#include "table.h"
+#include "tree.h"
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Table, with a malloc'ed copy of every key, against a compact table of the
+ * same keys, on paths and on URLs. Paths come from scanning directories or
+ * from a list, URLs from a list or else a generator that mimics a crawl: a
+ * few popular hosts, and paths built from a small vocabulary. Reports memory
+ * per key, counting malloc's own overhead for Table's keys, and hit and miss
+ * times.
+ */
+
+#define DEFAULT_ROOT "/usr"
+#define N_URLS 200000
+#define N_HOSTS 2000
+#define MISS_SUFFIX "~"
+
+/* Keeps the lookups from being optimised out */
+static volatile uintptr_t sink;
+
+static const char *const words[] = {
+	"news", "shop", "blog", "wiki", "static", "api", "images", "product",
+	"user", "profile", "search", "tag", "2023", "2024", "article", "video",
+	"media", "docs", "help", "en-us", "cart", "item", "share", "comments",
+	"feed", "assets", "css", "js",
+};
+#define N_WORDS (sizeof(words) / sizeof(*words))
+
+static const char *const tlds[] = {"com", "org", "net", "io", "co.uk", "de"};
+#define N_TLDS (sizeof(tlds) / sizeof(*tlds))
+
+struct Keys {
+	size_t n;
+	size_t cap;
+	char **keys;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static int
+keys_add(struct Keys *k, const char *key)
+{
+	if (k->n == k->cap) {
+		const size_t cap = k->cap ? 2 * k->cap : 1024;
+		char **keys = realloc(k->keys, cap * sizeof(*keys));
+
+		if (!keys)
+			return -1;
+		k->keys = keys;
+		k->cap = cap;
+	}
+	k->keys[k->n] = strdup(key);
+	return k->keys[k->n++] ? 0 : -1;
+}
+
+static void
+keys_destroy(struct Keys *k)
+{
+	for (size_t i = 0; i < k->n; i++)
+		free(k->keys[i]);
+	free(k->keys);
+}
+
+static int
+keys_scan(struct Keys *k, const char *root)
+{
+	struct Manifest man;
+
+	if (tree_scan(root, &man))
+		return -1;
+	/* entries[0] is the root itself */
+	for (size_t i = 1; i < man.n_entries; i++)
+		if (keys_add(k, manifest_path(&man, man.entries + i)))
+			return -1;
+	manifest_destroy(&man);
+	return 0;
+}
+
+/* One key per line */
+static int
+keys_read(struct Keys *k, const char *file)
+{
+	FILE *f = fopen(file, "r");
+	char line[4096];
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (*line && keys_add(k, line)) {
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+/* Hosts are picked with a heavy skew, as a crawl would revisit them */
+static int
+keys_urls(struct Keys *k, size_t n)
+{
+	uint64_t seed = 0x9e3779b97f4a7c15;
+	char url[512];
+
+	for (size_t i = 0; i < n; i++) {
+		const double r = (double)(xorshift(&seed) % 1000000) / 1e6;
+		const uint64_t host = (uint64_t)(r * r * r * N_HOSTS);
+		const unsigned n_segs = 1 + (unsigned)(xorshift(&seed) % 4);
+		int len;
+
+		len = snprintf(
+			url,
+			sizeof(url),
+			"https://www.%s%u.%s",
+			words[host % N_WORDS],
+			(unsigned)host,
+			tlds[host % N_TLDS]
+		);
+		for (unsigned j = 0; j < n_segs; j++)
+			len += snprintf(
+				url + len,
+				sizeof(url) - (size_t)len,
+				"/%s",
+				words[xorshift(&seed) % N_WORDS]
+			);
+		snprintf(
+			url + len,
+			sizeof(url) - (size_t)len,
+			xorshift(&seed) % 2 ? "/%u.html" : "?id=%u",
+			(unsigned)(xorshift(&seed) % 100000)
+		);
+		if (keys_add(k, url))
+			return -1;
+	}
+	return 0;
+}
+
+static int
+run(const char *name, const struct Keys *k)
+{
+	struct Table tbl;
+	struct CompactTable c;
+	size_t key_bytes = 0, tbl_bytes, *order, pos = 0;
+	const char *key;
+	void *val;
+	char (*misses)[4096];
+	uint64_t seed = 0x2545f4914f6cdd1d;
+	const size_t n_misses = k->n < 10000 ? k->n : 10000;
+	double t;
+
+	order = malloc(k->n * sizeof(*order));
+	misses = malloc(n_misses * sizeof(*misses));
+	if (!order || !misses || table_init(&tbl))
+		return -1;
+	for (size_t i = 0; i < k->n; i++) {
+		order[i] = xorshift(&seed) % k->n;
+		if (table_insert(&tbl, k->keys[i], (void *)(uintptr_t)(i + 1)))
+			return -1;
+	}
+	for (size_t i = 0; i < n_misses; i++)
+		snprintf(
+			misses[i],
+			sizeof(*misses),
+			"%s" MISS_SUFFIX,
+			k->keys[order[i]]
+		);
+
+	/* What a malloc'ed key really costs, header included */
+	tbl_bytes = tbl.n_slots * sizeof(*tbl.slots);
+	while (table_next(&tbl, &pos, &key, &val)) {
+		key_bytes += strlen(key) + 1;
+		tbl_bytes +=
+			malloc_usable_size((void *)(uintptr_t)key) + sizeof(size_t);
+	}
+	if (table_compact(&tbl, &c))
+		return -1;
+
+	printf(
+		"%s: %zu keys, %.1f bytes/key of key text, %.1f front coded\n",
+		name,
+		tbl.n_filled,
+		(double)key_bytes / (double)tbl.n_filled,
+		(double)c.keys_len / (double)c.n
+	);
+	printf(
+		"%-8s %12s %9s %9s %9s\n",
+		"layout",
+		"bytes",
+		"B/key",
+		"find ns",
+		"miss ns"
+	);
+
+	t = now();
+	for (size_t i = 0; i < k->n; i++)
+		sink += (uintptr_t)*table_find(&tbl, k->keys[order[i]]);
+	printf(
+		"%-8s %12zu %9.1f %9.1f",
+		"table",
+		tbl_bytes,
+		(double)tbl_bytes / (double)tbl.n_filled,
+		(now() - t) * 1e9 / (double)k->n
+	);
+	t = now();
+	for (size_t i = 0; i < n_misses; i++)
+		sink += table_find(&tbl, misses[i]) != NULL;
+	printf(" %9.1f\n", (now() - t) * 1e9 / (double)n_misses);
+
+	t = now();
+	for (size_t i = 0; i < k->n; i++)
+		sink += (uintptr_t)*compact_find(&c, k->keys[order[i]]);
+	printf(
+		"%-8s %12zu %9.1f %9.1f",
+		"compact",
+		c.n_bytes,
+		(double)c.n_bytes / (double)c.n,
+		(now() - t) * 1e9 / (double)k->n
+	);
+	t = now();
+	for (size_t i = 0; i < n_misses; i++)
+		sink += compact_find(&c, misses[i]) != NULL;
+	printf(" %9.1f\n", (now() - t) * 1e9 / (double)n_misses);
+
+	compact_destroy(&c);
+	table_destroy(&tbl);
+	free(misses);
+	free(order);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct Keys paths = {0}, urls = {0};
+	int ret = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			if (keys_read(&paths, argv[++i])) {
+				perror(argv[i]);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "-u") && i + 1 < argc) {
+			if (keys_read(&urls, argv[++i])) {
+				perror(argv[i]);
+				return 1;
+			}
+		} else if (argv[i][0] == '-' || keys_scan(&paths, argv[i])) {
+			fprintf(
+				stderr,
+				"usage: %s [<dir> | -f <paths>]... [-u <urls>]...\n",
+				argv[0]
+			);
+			return 1;
+		}
+	}
+	if (!paths.n && keys_scan(&paths, DEFAULT_ROOT)) {
+		perror(DEFAULT_ROOT);
+		return 1;
+	}
+	if (!urls.n && keys_urls(&urls, N_URLS)) {
+		perror("urls");
+		return 1;
+	}
+
+	if (run("paths", &paths)) {
+		perror("paths");
+		ret = 1;
+	}
+	printf("\n");
+	if (run("urls", &urls)) {
+		perror("urls");
+		ret = 1;
+	}
+	keys_destroy(&urls);
+	keys_destroy(&paths);
+	return ret;
+}
@@ -0,0 +1,150 @@
+#include "table.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Lookups that mostly miss, with the Bloom filter off and at a range of
+ * sizes: what each costs in memory, how many misses still get through to the
+ * slots, and the time per lookup on pure misses, pure hits and an 80% miss mix.
+ */
+
+#define KEY_WIDTH 16
+#define DEFAULT_KEYS (1UL << 20)
+#define MISS_PERCENT 80
+
+/* Keeps the lookups from being optimised out */
+static volatile uintptr_t sink;
+
+static const unsigned ratios[] = {0, 1, 2, 4, 8, 16};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/* ns per lookup, picking from misses with the given percentage */
+static double
+lookups(struct Table *tbl, char *keys, char *absent, size_t n, unsigned miss)
+{
+	uint64_t seed = 0x9e3779b97f4a7c15;
+	double t = now();
+
+	for (size_t i = 0; i < n; i++) {
+		const uint64_t r = xorshift(&seed);
+		const char *key = r % 100 < miss ? absent : keys;
+		void **val = table_find(tbl, key + (r >> 8) % n * KEY_WIDTH);
+
+		sink += val ? (uintptr_t)*val : 1;
+	}
+	return (now() - t) * 1e9 / (double)n;
+}
+
+static char *
+make_keys(size_t n, char prefix)
+{
+	char *keys = malloc(n * KEY_WIDTH);
+
+	if (!keys)
+		return NULL;
+	for (size_t i = 0; i < n; i++)
+		snprintf(
+			keys + i * KEY_WIDTH,
+			KEY_WIDTH,
+			"%c%014zx",
+			prefix,
+			i * 2654435761U & 0xffffffffffffffU
+		);
+	return keys;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t n_keys = DEFAULT_KEYS;
+	struct Table tbl;
+	char *keys, *absent;
+
+	if (argc > 1)
+		n_keys = strtoul(argv[1], NULL, 10);
+	if (!n_keys) {
+		fprintf(stderr, "usage: %s [n_keys]\n", argv[0]);
+		return 1;
+	}
+
+	keys = make_keys(n_keys, 'k');
+	absent = make_keys(n_keys, 'm');
+	if (!keys || !absent || table_init(&tbl)) {
+		perror("setup");
+		return 1;
+	}
+	/* Copied keys, so every strcmp goes through a pointer of its own */
+	for (size_t i = 0; i < n_keys; i++)
+		if (table_insert(&tbl, keys + i * KEY_WIDTH, (void *)(uintptr_t)i)) {
+			perror("insert");
+			return 1;
+		}
+
+	printf(
+		"%zu keys, %zu slots (%zu bytes)\n",
+		n_keys,
+		tbl.n_slots,
+		tbl.n_slots * sizeof(*tbl.slots)
+	);
+	printf(
+		"%5s %2s %12s %9s %8s %8s %8s %8s\n",
+		"ratio",
+		"k",
+		"filter B",
+		"B/key",
+		"fp %",
+		"miss ns",
+		"hit ns",
+		"mix ns"
+	);
+	for (size_t r = 0; r < sizeof(ratios) / sizeof(*ratios); r++) {
+		size_t bytes, passed = 0;
+
+		if (table_filter(&tbl, ratios[r])) {
+			perror("filter");
+			return 1;
+		}
+		bytes = tbl.filter
+			? tbl.n_filter_blocks * TABLE_FILTER_BLOCK * sizeof(*tbl.filter)
+			: 0;
+		for (size_t i = 0; i < n_keys; i++)
+			passed += (size_t)table_filter_pass(&tbl, absent + i * KEY_WIDTH);
+
+		printf(
+			"%5u %2u %12zu %9.2f %8.3f %8.1f %8.1f %8.1f\n",
+			ratios[r],
+			tbl.filter_k,
+			bytes,
+			(double)bytes / (double)n_keys,
+			100.0 * (double)passed / (double)n_keys,
+			lookups(&tbl, keys, absent, n_keys, 100),
+			lookups(&tbl, keys, absent, n_keys, 0),
+			lookups(&tbl, keys, absent, n_keys, MISS_PERCENT)
+		);
+	}
+
+	table_destroy(&tbl);
+	free(absent);
+	free(keys);
+	return 0;
+}
@@ -0,0 +1,186 @@
+#include "table.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+/*
+ * Random lookups into a big table, with its slots on each allocator backend,
+ * counting dTLB misses where perf events are available. For the 100M-slot
+ * case run with 50000000 keys (2^27 slots, ~2GiB of slots plus 800MiB of keys).
+ */
+
+#define KEY_WIDTH 16
+#define DEFAULT_KEYS (1UL << 22)
+
+/* Keeps the lookups from being optimised out */
+static volatile uintptr_t sink;
+
+struct Backend {
+	const char *name;
+	int mmap;
+	unsigned flags;
+};
+
+static const struct Backend backends[] = {
+	{"malloc", 0, 0},
+	{"mmap", 1, 0},
+	{"mmap 2M", 1, TABLE_ALLOC_HUGE_2M},
+	{"mmap 1G", 1, TABLE_ALLOC_HUGE_1G},
+	{"mmap 2M numa", 1, TABLE_ALLOC_HUGE_2M | TABLE_ALLOC_NUMA_LOCAL},
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* dTLB read misses of this thread in user space, or -1 */
+static int
+tlb_counter(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB |
+		PERF_COUNT_HW_CACHE_OP_READ << 8 |
+		PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t
+xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static int
+run(const struct Backend *b, char *keys, size_t n_keys, int counter)
+{
+	struct Table tbl;
+	struct TableAlloc alloc = table_alloc_malloc;
+	double t_insert, t_find;
+	uint64_t misses = 0, seed = 0x9e3779b97f4a7c15;
+
+	if (b->mmap)
+		table_alloc_mmap(&alloc, b->flags);
+	if (table_init_alloc(&tbl, &alloc))
+		return -1;
+	tbl.borrow_keys = 1;
+
+	t_insert = now();
+	for (size_t i = 0; i < n_keys; i++)
+		if (table_insert(&tbl, keys + i * KEY_WIDTH, (void *)(uintptr_t)i))
+			goto cleanup_fail;
+	t_insert = now() - t_insert;
+
+	if (counter != -1) {
+		ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+		ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	t_find = now();
+	for (size_t i = 0; i < n_keys; i++) {
+		const size_t k = xorshift(&seed) % n_keys;
+		void **val = table_find(&tbl, keys + k * KEY_WIDTH);
+
+		sink += (uintptr_t)*val;
+	}
+	t_find = now() - t_find;
+	if (counter != -1) {
+		ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(counter, &misses, sizeof(misses)) != sizeof(misses))
+			misses = 0;
+	}
+
+	printf(
+		"%-14s %12zu %10.1f %10.1f",
+		b->name,
+		tbl.n_slots,
+		t_insert * 1e9 / (double)n_keys,
+		t_find * 1e9 / (double)n_keys
+	);
+	if (counter != -1)
+		printf(" %12.3f", (double)misses / (double)n_keys);
+	else
+		printf(" %12s", "n/a");
+	putchar('\n');
+	table_destroy(&tbl);
+	return 0;
+
+cleanup_fail:
+	table_destroy(&tbl);
+	return -1;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t n_keys = DEFAULT_KEYS;
+	struct TableAlloc key_alloc;
+	char *keys;
+	int counter;
+
+	if (argc > 1)
+		n_keys = strtoul(argv[1], NULL, 10);
+	if (!n_keys) {
+		fprintf(stderr, "usage: %s [n_keys]\n", argv[0]);
+		return 1;
+	}
+
+	/* Keys sit on huge pages whatever the backend, so the difference
+	 * between runs is down to the slot arrays */
+	table_alloc_mmap(&key_alloc, TABLE_ALLOC_HUGE_2M);
+	keys = key_alloc.alloc(key_alloc.ctx, n_keys * KEY_WIDTH);
+	if (!keys) {
+		perror("keys");
+		return 1;
+	}
+	for (size_t i = 0; i < n_keys; i++)
+		snprintf(
+			keys + i * KEY_WIDTH,
+			KEY_WIDTH,
+			"k%014zx",
+			i * 2654435761U & 0xffffffffffffffU
+		);
+
+	counter = tlb_counter();
+	if (counter == -1)
+		fprintf(stderr, "no dTLB counter, reporting times only\n");
+
+	printf("%zu keys, random lookups\n", n_keys);
+	printf(
+		"%-14s %12s %10s %10s %12s\n",
+		"backend",
+		"slots",
+		"insert ns",
+		"find ns",
+		"dTLB miss/op"
+	);
+	for (size_t i = 0; i < sizeof(backends) / sizeof(*backends); i++)
+		if (run(backends + i, keys, n_keys, counter)) {
+			fprintf(stderr, "%s: out of memory\n", backends[i].name);
+			return 1;
+		}
+
+	key_alloc.free(key_alloc.ctx, keys, n_keys * KEY_WIDTH);
+	return 0;
+}
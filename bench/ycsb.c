@@ -0,0 +1,690 @@
+#include "hash.h"
+#include "table.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * YCSB-style workloads against Table, and against a separate chaining map
+ * built like std::unordered_map (a node per entry, a bucket array of
+ * pointers, max load factor 1) as a baseline. Keys are loaded first, then
+ * ops are drawn from a read/update/insert/delete mix, with key popularity
+ * uniform, Zipfian, or Zipfian over recency ("latest"). Every op is timed
+ * on its own, less the cost of reading the clock; key generation isn't.
+ *
+ * Presets follow YCSB's core workloads where they map onto a key-value table:
+ *   a  50% read, 50% update, zipfian
+ *   b  95% read, 5% update, zipfian
+ *   c  100% read, zipfian
+ *   d  95% read, 5% insert, latest
+ *   x  50% read, 10% update, 20% insert, 20% delete, zipfian (churn)
+ */
+
+#define KEY_MAX 128
+#define HASH_BATCH 1024
+#define DEFAULT_RECORDS 1000000
+#define DEFAULT_OPS 1000000
+#define DEFAULT_THETA 0.99
+
+enum Op { op_read, op_update, op_insert, op_delete, n_op_types };
+enum Dist { dist_uniform, dist_zipfian, dist_latest };
+
+static const char *op_names[] = {"read", "update", "insert", "delete"};
+static const char *dist_names[] = {"uniform", "zipfian", "latest"};
+
+struct Workload {
+	unsigned mix[n_op_types]; /* percentages */
+	enum Dist dist;
+	double theta;
+	int path_keys;
+	size_t n_records;
+	size_t n_ops;
+};
+
+/* Zipfian ranks over [0, n), after Gray et al., "Quickly Generating
+ * Billion-Record Synthetic Databases". n can grow, zeta is kept running. */
+struct Zipf {
+	size_t n;
+	double theta, alpha, zeta2, zetan, eta;
+};
+
+/* Uniform driver for a data structure under test */
+struct Target {
+	const char *name;
+	void *(*init)(void);
+	void (*destroy)(void *map);
+	void **(*find)(void *map, const char *key);
+	int (*insert)(void *map, const char *key, void *val);
+	int (*delete)(void *map, const char *key);
+};
+
+struct ChainNode {
+	struct ChainNode *next;
+	uint32_t hash;
+	void *val;
+	char key[];
+};
+
+struct Chain {
+	struct ChainNode **buckets;
+	size_t n_buckets; /* 2^k */
+	size_t n;
+};
+
+/* Keeps the lookups from being optimised out */
+static volatile uintptr_t sink;
+static uint32_t clock_ns; /* of a back to back pair of clock_gettime */
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/* Uniform on [0, 1) */
+static double
+uniform(uint64_t *s)
+{
+	return (double)(xorshift(s) >> 11) * 0x1.0p-53;
+}
+
+static void
+zipf_grow(struct Zipf *z, size_t n)
+{
+	for (size_t i = z->n + 1; i <= n; i++)
+		z->zetan += 1.0 / pow((double)i, z->theta);
+	z->n = n;
+	z->eta = (1.0 - pow(2.0 / (double)n, 1.0 - z->theta)) /
+		(1.0 - z->zeta2 / z->zetan);
+}
+
+static void
+zipf_init(struct Zipf *z, size_t n, double theta)
+{
+	z->n = 0;
+	z->theta = theta;
+	z->alpha = 1.0 / (1.0 - theta);
+	z->zeta2 = 1.0 + pow(0.5, theta);
+	z->zetan = 0;
+	zipf_grow(z, n);
+}
+
+static size_t
+zipf_next(const struct Zipf *z, uint64_t *s)
+{
+	const double u = uniform(s);
+	const double uz = u * z->zetan;
+	size_t rank;
+
+	if (uz < 1.0)
+		return 0;
+	if (uz < z->zeta2)
+		return 1;
+	rank = (size_t)((double)z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+	return rank < z->n ? rank : z->n - 1;
+}
+
+/* Key of the given record. Path keys look like a source tree, so they share
+ * long prefixes and only differ near the end. */
+static void
+key_of(const struct Workload *w, size_t id, char *buf)
+{
+	static const char *tops[] = {"src", "include", "lib", "tests"};
+	static const char *subs[] = {
+		"core", "net", "fs", "util", "io", "mem", "sched", "ipc"
+	};
+	uint64_t h = id * 0x9e3779b97f4a7c15U;
+	int len;
+	unsigned depth;
+
+	if (!w->path_keys) {
+		sprintf(buf, "user%016llx", (unsigned long long)h);
+		return;
+	}
+
+	len = sprintf(buf, "/home/build/project/%s", tops[h >> 62]);
+	depth = 1 + (unsigned)(h >> 60 & 3);
+	for (unsigned i = 0; i < depth; i++)
+		len += sprintf(buf + len, "/%s", subs[h >> (57 - 3 * i) & 7]);
+	sprintf(buf + len, "/file%zu.c", id);
+}
+
+/* Record to operate on: uniform or Zipfian over all of them, Zipfian ranks
+ * scrambled so the popular ones aren't all neighbours, or for "latest" the
+ * most recently inserted first. */
+static size_t
+choose(
+	const struct Workload *w,
+	const struct Zipf *z,
+	size_t n_keys,
+	uint64_t *s
+)
+{
+	switch (w->dist) {
+	case dist_uniform:
+		return xorshift(s) % n_keys;
+	case dist_zipfian:
+		return (size_t)(zipf_next(z, s) * 0xff51afd7ed558ccdU % n_keys);
+	case dist_latest:
+		return n_keys - 1 - zipf_next(z, s);
+	}
+	return 0;
+}
+
+static void *
+table_target_init(void)
+{
+	struct Table *tbl = malloc(sizeof(*tbl));
+
+	if (tbl && table_init(tbl)) {
+		free(tbl);
+		return NULL;
+	}
+	return tbl;
+}
+
+static void
+table_target_destroy(void *map)
+{
+	table_destroy(map);
+	free(map);
+}
+
+static void **
+table_target_find(void *map, const char *key)
+{
+	return table_find(map, key);
+}
+
+static int
+table_target_insert(void *map, const char *key, void *val)
+{
+	return table_insert(map, key, val);
+}
+
+static int
+table_target_delete(void *map, const char *key)
+{
+	return table_delete(map, key);
+}
+
+static void *
+chain_init(void)
+{
+	struct Chain *c = malloc(sizeof(*c));
+
+	if (!c)
+		return NULL;
+	c->n_buckets = 16;
+	c->n = 0;
+	c->buckets = calloc(c->n_buckets, sizeof(*c->buckets));
+	if (!c->buckets) {
+		free(c);
+		return NULL;
+	}
+	return c;
+}
+
+static void
+chain_destroy(void *map)
+{
+	struct Chain *c = map;
+	struct ChainNode *node, *next;
+
+	for (size_t i = 0; i < c->n_buckets; i++)
+		for (node = c->buckets[i]; node; node = next) {
+			next = node->next;
+			free(node);
+		}
+	free(c->buckets);
+	free(c);
+}
+
+static struct ChainNode **
+chain_slot(struct Chain *c, const char *key, uint32_t hash)
+{
+	struct ChainNode **p = c->buckets + (hash & (c->n_buckets - 1));
+
+	while (*p && ((*p)->hash != hash || strcmp((*p)->key, key)))
+		p = &(*p)->next;
+	return p;
+}
+
+static void **
+chain_find(void *map, const char *key)
+{
+	struct ChainNode **p =
+		chain_slot(map, key, HASH_STR_32((const unsigned char *)key));
+
+	return *p ? &(*p)->val : NULL;
+}
+
+static int
+chain_insert(void *map, const char *key, void *val)
+{
+	struct Chain *c = map;
+	const uint32_t hash = HASH_STR_32((const unsigned char *)key);
+	struct ChainNode **p = chain_slot(c, key, hash);
+	struct ChainNode *node;
+	size_t len;
+
+	if (*p) {
+		(*p)->val = val;
+		return 0;
+	}
+
+	if (c->n + 1 > c->n_buckets) {
+		const size_t n_buckets = c->n_buckets << 1;
+		struct ChainNode **buckets = calloc(n_buckets, sizeof(*buckets));
+		struct ChainNode *next;
+
+		if (!buckets)
+			return -1;
+		for (size_t i = 0; i < c->n_buckets; i++)
+			for (node = c->buckets[i]; node; node = next) {
+				next = node->next;
+				node->next = buckets[node->hash & (n_buckets - 1)];
+				buckets[node->hash & (n_buckets - 1)] = node;
+			}
+		free(c->buckets);
+		c->buckets = buckets;
+		c->n_buckets = n_buckets;
+		p = c->buckets + (hash & (n_buckets - 1));
+	}
+
+	len = strlen(key) + 1;
+	node = malloc(sizeof(*node) + len);
+	if (!node)
+		return -1;
+	node->hash = hash;
+	node->val = val;
+	memcpy(node->key, key, len);
+	node->next = *p;
+	*p = node;
+	c->n++;
+	return 0;
+}
+
+static int
+chain_delete(void *map, const char *key)
+{
+	struct Chain *c = map;
+	struct ChainNode **p =
+		chain_slot(c, key, HASH_STR_32((const unsigned char *)key));
+	struct ChainNode *node = *p;
+
+	if (!node)
+		return -1;
+	*p = node->next;
+	free(node);
+	c->n--;
+	return 0;
+}
+
+static const struct Target targets[] = {
+	{
+		"table",
+		table_target_init,
+		table_target_destroy,
+		table_target_find,
+		table_target_insert,
+		table_target_delete,
+	},
+	{
+		"chain",
+		chain_init,
+		chain_destroy,
+		chain_find,
+		chain_insert,
+		chain_delete,
+	},
+};
+
+static int
+cmp_u32(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+report(const char *name, const char *op, uint32_t *lat, size_t n)
+{
+	uint64_t total = 0;
+
+	if (!n)
+		return;
+	for (size_t i = 0; i < n; i++)
+		total += lat[i];
+	qsort(lat, n, sizeof(*lat), cmp_u32);
+	printf(
+		"%-6s %-7s %9zu %9.2f %7u %7u %7u %7u %8u\n",
+		name,
+		op,
+		n,
+		(double)n * 1e3 / (double)(total ? total : 1),
+		lat[n / 2],
+		lat[n * 90 / 100],
+		lat[n * 99 / 100],
+		lat[n * 999 / 1000],
+		lat[n - 1]
+	);
+}
+
+static uint32_t
+elapsed_ns(const struct timespec *a, const struct timespec *b)
+{
+	const long ns =
+		(b->tv_sec - a->tv_sec) * 1000000000L + (b->tv_nsec - a->tv_nsec);
+
+	return ns > (long)clock_ns ? (uint32_t)ns - clock_ns : 0;
+}
+
+static void
+calibrate_clock(void)
+{
+	uint32_t lat[1001];
+	struct timespec t0, t1;
+
+	clock_ns = 0;
+	for (size_t i = 0; i < sizeof(lat) / sizeof(*lat); i++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		lat[i] = elapsed_ns(&t0, &t1);
+	}
+	qsort(lat, sizeof(lat) / sizeof(*lat), sizeof(*lat), cmp_u32);
+	clock_ns = lat[sizeof(lat) / sizeof(*lat) / 2];
+}
+
+static int
+run(const struct Target *t, const struct Workload *w)
+{
+	void *map;
+	struct Zipf z;
+	struct timespec t0, t1;
+	uint32_t *lat[n_op_types] = {NULL};
+	size_t n_lat[n_op_types] = {0}, n_keys = w->n_records;
+	uint64_t seed = 0x2545f4914f6cdd1dU;
+	char key[KEY_MAX];
+	double t_load;
+	int ret = -1;
+
+	map = t->init();
+	if (!map)
+		return -1;
+	for (size_t i = 0; i < n_op_types; i++) {
+		lat[i] = malloc(w->n_ops * sizeof(*lat[i]));
+		if (!lat[i])
+			goto cleanup;
+	}
+
+	t_load = now();
+	for (size_t i = 0; i < w->n_records; i++) {
+		key_of(w, i, key);
+		if (t->insert(map, key, (void *)(uintptr_t)(i + 1)))
+			goto cleanup;
+	}
+	t_load = now() - t_load;
+	printf(
+		"%-6s %-7s %9zu %9.2f\n",
+		t->name,
+		"load",
+		w->n_records,
+		(double)w->n_records / t_load / 1e6
+	);
+
+	if (w->dist != dist_uniform)
+		zipf_init(&z, n_keys, w->theta);
+	for (size_t i = 0; i < w->n_ops; i++) {
+		const unsigned pick = (unsigned)(xorshift(&seed) % 100);
+		unsigned op = 0, acc = w->mix[0];
+		size_t id;
+
+		while (pick >= acc)
+			acc += w->mix[++op];
+		if (op == op_insert) {
+			id = n_keys++;
+			if (w->dist != dist_uniform)
+				zipf_grow(&z, n_keys);
+		} else {
+			id = choose(w, &z, n_keys, &seed);
+		}
+		key_of(w, id, key);
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		switch (op) {
+		case op_read: {
+			void **val = t->find(map, key);
+
+			sink += val ? (uintptr_t)*val : 0;
+			break;
+		}
+		case op_update:
+		case op_insert:
+			if (t->insert(map, key, (void *)(uintptr_t)(i + 1)))
+				goto cleanup;
+			break;
+		case op_delete:
+			sink += (uintptr_t)t->delete(map, key);
+			break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		lat[op][n_lat[op]++] = elapsed_ns(&t0, &t1);
+	}
+
+	for (size_t i = 0; i < n_op_types; i++)
+		report(t->name, op_names[i], lat[i], n_lat[i]);
+	ret = 0;
+
+cleanup:
+	for (size_t i = 0; i < n_op_types; i++)
+		free(lat[i]);
+	t->destroy(map);
+	return ret;
+}
+
+/* Time HASH_STR_32 over the loaded keys, as it's in every op above */
+static int
+bench_hash(const struct Workload *w)
+{
+	char (*keys)[KEY_MAX];
+	size_t bytes = 0;
+	double t = 0, t0;
+
+	keys = malloc(HASH_BATCH * sizeof(*keys));
+	if (!keys)
+		return -1;
+	for (size_t i = 0; i < w->n_records; i += HASH_BATCH) {
+		const size_t n =
+			w->n_records - i < HASH_BATCH ? w->n_records - i : HASH_BATCH;
+
+		for (size_t j = 0; j < n; j++) {
+			key_of(w, i + j, keys[j]);
+			bytes += strlen(keys[j]);
+		}
+		t0 = now();
+		for (size_t j = 0; j < n; j++)
+			sink += HASH_STR_32((unsigned char *)keys[j]);
+		t += now() - t0;
+	}
+	free(keys);
+	printf(
+		"hash: %.1f ns/key, %.1f bytes/key\n",
+		t * 1e9 / (double)w->n_records,
+		(double)bytes / (double)w->n_records
+	);
+	return 0;
+}
+
+static int
+preset(struct Workload *w, char name)
+{
+	static const struct {
+		char name;
+		unsigned mix[n_op_types];
+		enum Dist dist;
+	} presets[] = {
+		{'a', {50, 50, 0, 0}, dist_zipfian},
+		{'b', {95, 5, 0, 0}, dist_zipfian},
+		{'c', {100, 0, 0, 0}, dist_zipfian},
+		{'d', {95, 0, 5, 0}, dist_latest},
+		{'x', {50, 10, 20, 20}, dist_zipfian},
+	};
+
+	for (size_t i = 0; i < sizeof(presets) / sizeof(*presets); i++) {
+		if (presets[i].name != name)
+			continue;
+		memcpy(w->mix, presets[i].mix, sizeof(w->mix));
+		w->dist = presets[i].dist;
+		return 0;
+	}
+	return -1;
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(
+		stderr,
+		"Usage: %s [-w a|b|c|d|x] [-m <r>:<u>:<i>:<d>] [-D <dist>]\n"
+		"          [-z <theta>] [-n <records>] [-o <ops>] [-p]\n"
+		"          [-t table|chain]\n"
+		"  -w  preset workload (default a)\n"
+		"  -m  read:update:insert:delete percentages\n"
+		"  -D  key popularity: uniform, zipfian or latest\n"
+		"  -z  zipfian skew, in (0, 1) (default %.2f)\n"
+		"  -n  records loaded first (default %d)\n"
+		"  -o  ops to run (default %d)\n"
+		"  -p  path-like keys instead of user<hex>\n"
+		"  -t  only run one target\n",
+		argv0,
+		DEFAULT_THETA,
+		DEFAULT_RECORDS,
+		DEFAULT_OPS
+	);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct Workload w = {
+		.theta = DEFAULT_THETA,
+		.n_records = DEFAULT_RECORDS,
+		.n_ops = DEFAULT_OPS,
+	};
+	const char *only = NULL;
+	int opt;
+
+	preset(&w, 'a');
+	while ((opt = getopt(argc, argv, "w:m:D:z:n:o:pt:h")) != -1) {
+		switch (opt) {
+		case 'w':
+			if (strlen(optarg) != 1 || preset(&w, optarg[0]))
+				goto usage_fail;
+			break;
+		case 'm':
+			if (sscanf(
+					optarg,
+					"%u:%u:%u:%u",
+					w.mix + op_read,
+					w.mix + op_update,
+					w.mix + op_insert,
+					w.mix + op_delete
+				) != 4)
+				goto usage_fail;
+			break;
+		case 'D':
+			for (w.dist = 0; w.dist <= dist_latest; w.dist++)
+				if (!strcmp(optarg, dist_names[w.dist]))
+					break;
+			if (w.dist > dist_latest)
+				goto usage_fail;
+			break;
+		case 'z':
+			w.theta = strtod(optarg, NULL);
+			break;
+		case 'n':
+			w.n_records = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			w.n_ops = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			w.path_keys = 1;
+			break;
+		case 't':
+			only = optarg;
+			break;
+		default:
+			goto usage_fail;
+		}
+	}
+	if (w.mix[0] + w.mix[1] + w.mix[2] + w.mix[3] != 100 || !w.n_records ||
+	    !(w.theta > 0 && w.theta < 1) || w.n_ops > UINT32_MAX)
+		goto usage_fail;
+
+	printf(
+		"read %u%% update %u%% insert %u%% delete %u%%, %s",
+		w.mix[op_read],
+		w.mix[op_update],
+		w.mix[op_insert],
+		w.mix[op_delete],
+		dist_names[w.dist]
+	);
+	if (w.dist != dist_uniform)
+		printf(" (theta %.2f)", w.theta);
+	printf(
+		", %s keys\n%zu records, %zu ops\n",
+		w.path_keys ? "path" : "user",
+		w.n_records,
+		w.n_ops
+	);
+	if (bench_hash(&w)) {
+		perror("hash");
+		return 1;
+	}
+	calibrate_clock();
+	printf(
+		"%-6s %-7s %9s %9s %7s %7s %7s %7s %8s\n",
+		"target",
+		"op",
+		"count",
+		"Mops/s",
+		"p50 ns",
+		"p90",
+		"p99",
+		"p99.9",
+		"max"
+	);
+	for (size_t i = 0; i < sizeof(targets) / sizeof(*targets); i++) {
+		if (only && strcmp(only, targets[i].name))
+			continue;
+		if (run(targets + i, &w)) {
+			fprintf(stderr, "%s: out of memory\n", targets[i].name);
+			return 1;
+		}
+	}
+	return 0;
+
+usage_fail:
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,58 @@
+#ifndef INCLUDE_ART_H
+#define INCLUDE_ART_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Adaptive radix tree (Leis et al., "The Adaptive Radix Tree: ARTful Indexing
+ * for Main-Memory Databases"), for keys like paths that share long prefixes.
+ * Inner nodes hold 4, 16, 48 or 256 children and change size as they fill
+ * and empty, common prefixes are collapsed into the node, and keys are kept in
+ * order, so everything under a prefix can be walked. Keys are null-terminated
+ * and copied into the leaves.
+ */
+
+#define ART_PREFIX_MAX 10 /* prefix bytes kept in a node, the rest is checked
+                           * against a leaf */
+
+struct ArtNode;
+
+struct Art {
+	struct ArtNode *root;
+	size_t n_keys;
+	size_t n_bytes; /* allocated for nodes and leaves */
+};
+
+/* Initialise an empty tree. */
+int
+art_init(struct Art *t);
+
+/* Deallocate a tree. */
+void
+art_destroy(struct Art *t);
+
+/* Find a value, return a pointer to it or NULL if key isn't there. Unlike
+ * table_find the pointer stays put until key is deleted. */
+void **
+art_find(struct Art *t, const char *key);
+
+/* Insert or update key, val is simply a pointer and will not be copied. */
+int
+art_insert(struct Art *t, const char *key, void *val);
+
+/* Remove key from the tree, -1 if it isn't there. */
+int
+art_delete(struct Art *t, const char *key);
+
+/* Call fn on every key starting with prefix, in order, until it returns
+ * nonzero. Returns that, or 0. The tree mustn't change meanwhile. */
+int
+art_prefix(
+	struct Art *t,
+	const char *prefix,
+	int (*fn)(const char *key, void *val, void *ctx),
+	void *ctx
+);
+
+#endif
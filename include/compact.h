@@ -0,0 +1,59 @@
+#ifndef INCLUDE_COMPACT_H
+#define INCLUDE_COMPACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "table.h"
+
+/*
+ * Compact tables, for read-mostly key sets where the keys themselves are most
+ * of the memory. Keys are sorted and front coded in blocks: each key is stored
+ * as the length of the prefix it shares with the one before it, then the rest.
+ * Every COMPACT_BLOCK_KEYS-th key starts a block and is stored whole, so a key
+ * is decoded from the start of its block. Slots keep 32 bits of each key's
+ * hash, and a key is only decoded when that matches, so a probe mostly costs
+ * what it does in a Table.
+ *
+ * A CompactTable is a structure of its own, built from a Table by
+ * table_compact, not a mode a Table can be put in. The two share nothing
+ * afterwards. Keys are fixed once built, values can be changed through
+ * compact_find.
+ */
+
+#define COMPACT_BLOCK_KEYS 16
+#define COMPACT_LOAD 75 /* percent of slots filled */
+
+struct CompactSlot {
+	uint32_t tag;  /* high half of the key's hash */
+	uint32_t rank; /* 1 + index of the key in sorted order, 0 if empty */
+};
+
+struct CompactTable {
+	size_t n;
+	size_t n_slots;
+	struct CompactSlot *slots;
+	void **vals;          /* by rank */
+	uint32_t *blocks;     /* by block, offsets into keys */
+	unsigned char *keys;  /* front coded */
+	size_t keys_len;
+	size_t n_bytes; /* allocated for all of the above */
+};
+
+/* Sort and front code the entries of tbl into c, only reading tbl. The 4GiB
+ * limit of 32-bit block offsets is on the front coded bytes, not the keys as
+ * they are in tbl, so it is only known, and checked, once they are coded.
+ * Returns -1 past it, or with more than 2^31 entries. */
+int
+table_compact(const struct Table *tbl, struct CompactTable *c);
+
+/* Deallocate a compact table. */
+void
+compact_destroy(struct CompactTable *c);
+
+/* Find a value, return a pointer to it or NULL if key isn't there. The
+ * pointer stays put for as long as the table. */
+void **
+compact_find(const struct CompactTable *c, const char *key);
+
+#endif
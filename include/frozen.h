@@ -0,0 +1,74 @@
+#ifndef INCLUDE_FROZEN_H
+#define INCLUDE_FROZEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "table.h"
+
+/*
+ * Read-only tables, frozen from a populated Table. Keys get a minimal perfect
+ * hash in the style of PTHash (Pibiri and Trani): keys are split into
+ * partitions, each partition's keys into buckets, and every bucket gets a
+ * "pilot" chosen so that its keys land on free slots. A lookup is one hash,
+ * one slot and one strcmp. Partitions are built in parallel.
+ *
+ * Everything lives in one block with the same layout as the file, so writing
+ * is one write and loading is one mmap. Values are kept as plain 64-bit
+ * numbers, so after a load they only mean something if they weren't
+ * pointers.
+ */
+
+#define FROZEN_THREADS 8
+#define FROZEN_PART_KEYS 4096 /* keys per partition, on average */
+#define FROZEN_BUCKET_C 5     /* buckets per key, times log2 of the keys */
+#define FROZEN_PILOT_MAX (1U << 20) /* then try another seed */
+#define FROZEN_SEEDS 8
+
+struct FrozenPart {
+	uint64_t base;       /* first slot */
+	uint64_t pilot_base; /* first pilot */
+	uint32_t n;          /* keys, and so slots */
+	uint32_t n_buckets;
+};
+
+struct FrozenTable {
+	size_t n;
+	size_t n_parts;
+	size_t n_pilots;
+	uint64_t seed;
+	const struct FrozenPart *parts;
+	const uint64_t *vals;    /* by slot */
+	const uint32_t *pilots;  /* by bucket */
+	const uint32_t *offsets; /* by slot, into keys */
+	const char *keys;        /* '\0'-terminated, in slot order */
+	size_t keys_len;
+
+	void *map; /* the whole block */
+	size_t map_len;
+	int mapped; /* map is from frozen_load, not malloc */
+};
+
+/* Hash the entries of tbl into f, only reading tbl. Keys are kept whole and
+ * '\0'-terminated behind 32-bit offsets, so returns -1 if they take 4GiB or
+ * more, or if no seed lets every partition place its buckets. */
+int
+table_freeze(const struct Table *tbl, struct FrozenTable *f);
+
+/* Deallocate or unmap a frozen table. */
+void
+frozen_destroy(struct FrozenTable *f);
+
+/* Put the value of key in *val, return -1 if key isn't there. */
+int
+frozen_find(const struct FrozenTable *f, const char *key, void **val);
+
+/* Write f out in its binary form. */
+int
+frozen_write(const struct FrozenTable *f, const char *filename);
+
+/* Map a table written by frozen_write. */
+int
+frozen_load(struct FrozenTable *f, const char *filename);
+
+#endif
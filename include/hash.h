@@ -1,6 +1,7 @@
 #ifndef INCLUDE_HASH_H
 #define INCLUDE_HASH_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 /* Use these */
@@ -9,6 +10,19 @@
 uint32_t
 djb2(const unsigned char *str);
 
+/* 64-bit FNV-1a with a seed and a final mix, for when 32 bits of djb2 are
+ * going to collide. */
+uint64_t
+fnv1a_64(const unsigned char *str, uint64_t seed);
+
+/* The same over len bytes, NULs and all. */
+uint64_t
+fnv1a_64_len(const unsigned char *buf, size_t len, uint64_t seed);
+
+/* Like hash_file, on a file already open for reading at its start. */
+int
+hash_fd(int fd, uint64_t *hash);
+
 int
 hash_file(char *filename, uint64_t *hash);
 
@@ -0,0 +1,54 @@
+#ifndef INCLUDE_INTERN_H
+#define INCLUDE_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "table.h"
+
+/*
+ * String interning. Each distinct string is stored once, in append-only pages
+ * that never move, and gets a dense 32-bit ID. The pointer for an ID stays
+ * valid until the pool is destroyed, so it can be shared and held on to, and
+ * other structures can key on IDs (or just index arrays by them) instead of
+ * copying and re-hashing the same strings.
+ */
+
+#define INTERN_PAGE_SIZE 65536
+#define INTERN_INIT_IDS 256
+
+struct InternPage {
+	struct InternPage *next; /* older pages */
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+struct Intern {
+	struct Table index; /* string -> ID + 1, keys borrowed from the pages */
+	char **strs;        /* ID -> string */
+	uint32_t n_strs;
+	uint32_t cap_strs;
+	struct InternPage *page; /* current page */
+};
+
+/* Initialise an empty pool. */
+int
+intern_init(struct Intern *in);
+
+/* Deallocate a pool and every string in it. */
+void
+intern_destroy(struct Intern *in);
+
+/* Put the ID of str in *id, adding str to the pool if it isn't already. */
+int
+intern(struct Intern *in, const char *str, uint32_t *id);
+
+/* Put the ID of str in *id, return -1 if it hasn't been interned. */
+int
+intern_find(struct Intern *in, const char *str, uint32_t *id);
+
+/* String with the given ID, which must have come from this pool. */
+#define intern_str(in, id) ((const char *)(in)->strs[id])
+
+#endif
@@ -7,28 +7,69 @@
 /*
  * Quick and dirty hash-tables, using linear probing. We'll just use djb2...
  * There are some tunables in the macros below.
+ *
+ * Slot arrays come from a per-table allocator, so big tables can sit on huge
+ * pages or a particular NUMA node. Key copies are small and always malloc'ed.
+ *
+ * Tables that mostly get asked about keys they don't have can keep a counting
+ * Bloom filter in front of the slots. Its 4-bit counters are grouped in cache
+ * line sized blocks, and each key only touches the one block, so a miss costs
+ * one cache line instead of a probe sequence of strcmps. Counters that
+ * saturate stay put, which can only cost false positives.
  */
 
 #define TABLE_INIT_SLOTS 32
 #define TABLE_RESIZE_RATIO 70
+#define TABLE_FILTER_BLOCK 8 /* 64-bit words, 128 counters, per filter block */
+
+/* Flags for the mmap backend */
+#define TABLE_ALLOC_HUGE_2M 0x1 /* transparent huge pages, via madvise */
+#define TABLE_ALLOC_HUGE_1G 0x2 /* hugetlbfs pages, else as HUGE_2M */
+#define TABLE_ALLOC_NUMA_LOCAL 0x4 /* prefer the node of the calling CPU */
 
 struct TableEntry {
 	char *key;
 	void *val;
 };
 
+struct TableAlloc {
+	/* Return size bytes of zeroed memory, or NULL */
+	void *(*alloc)(void *ctx, size_t size);
+	/* Release memory from alloc, given the same size */
+	void (*free)(void *ctx, void *ptr, size_t size);
+	void *ctx;
+};
+
+/* calloc and free, what table_init uses */
+extern const struct TableAlloc table_alloc_malloc;
+
 struct Table {
 	size_t n_slots; /* 2^k */
 	size_t n_filled;
 	size_t n_tomb; /* address of this field is tombstone */
 	struct TableEntry *slots;
-	struct TableEntry *more;  /* unused half to avoid expensive copy */
+	struct TableEntry *more;  /* spare array for exhuming, made on first use */
+	int borrow_keys; /* keys are the caller's: neither copied nor freed */
+	struct TableAlloc alloc;
+	uint64_t *filter; /* NULL if there isn't one */
+	size_t n_filter_blocks; /* 2^k */
+	unsigned filter_ratio;  /* counters per slot */
+	unsigned filter_k;      /* counters per key */
 };
 
 /* Initialise a table. */
 int
 table_init(struct Table *tbl);
 
+/* Initialise a table whose slot arrays come from alloc. */
+int
+table_init_alloc(struct Table *tbl, const struct TableAlloc *alloc);
+
+/* Fill in an allocator that maps slot arrays directly, with TABLE_ALLOC_*
+ * flags. Anything the system can't do is skipped rather than failed. */
+void
+table_alloc_mmap(struct TableAlloc *alloc, unsigned flags);
+
 /* Deallocate a table. */
 void
 table_destroy(struct Table *tbl);
@@ -40,8 +81,14 @@ table_destroy(struct Table *tbl);
 void **
 table_find(struct Table *tbl, const char *key);
 
+/* Step through the entries of a table: start with *pos at 0 and call until it
+ * returns 0. The table must not change in between. */
+int
+table_next(const struct Table *tbl, size_t *pos, const char **key, void **val);
+
 /* Insert item into table. Key must be null-terminated and can be ephermal,
- * val is simply a pointer and will not be copied. */
+ * unless borrow_keys is set, in which case it must outlive its entry. val is
+ * simply a pointer and will not be copied. */
 int
 table_insert(struct Table *tbl, const char *key, void *val);
 
@@ -49,4 +96,13 @@ table_insert(struct Table *tbl, const char *key, void *val);
 int
 table_delete(struct Table *tbl, const char *key);
 
+/* Keep a filter with ratio counters for each slot, and check it before
+ * probing. More counters means fewer false positives, 0 drops the filter. */
+int
+table_filter(struct Table *tbl, unsigned ratio);
+
+/* Whether the filter lets key through to the slots, 1 if there's no filter. */
+int
+table_filter_pass(struct Table *tbl, const char *key);
+
 #endif
@@ -0,0 +1,87 @@
+#ifndef INCLUDE_TREE_H
+#define INCLUDE_TREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "table.h"
+
+/*
+ * Directory trees as Merkle manifests. Files are hashed with hash_fd, and a
+ * directory's hash covers the names, types and hashes of its children, so a
+ * subtree whose hash matches between two manifests can be skipped whole.
+ *
+ * Entries are kept in preorder with siblings sorted by name, and each knows
+ * the size of its subtree, so skipping one is a single jump.
+ */
+
+#define TREE_SCAN_THREADS 8
+#define TREE_QUEUE_MAX 256 /* past this, workers descend themselves */
+
+enum TreeType {
+	tree_dir = 0,
+	tree_file,
+	tree_link, /* hashed by target, never followed */
+};
+
+struct TreeEntry {
+	uint64_t hash;
+	uint32_t path;   /* offset into the manifest's paths */
+	uint32_t n_desc; /* number of entries in the subtree below */
+	uint32_t type;
+	uint32_t pad;
+};
+
+struct Manifest {
+	size_t n_entries;
+	struct TreeEntry *entries; /* entries[0] is the root, path "" */
+	size_t paths_len;
+	char *paths; /* '\0'-terminated, relative to the root */
+	struct Table index; /* path -> entry index + 1 */
+
+	void *map; /* backing mapping if loaded from a file */
+	size_t map_len;
+};
+
+enum TreeChange {
+	tree_added = 0,
+	tree_removed,
+	tree_modified,
+};
+
+/* Scan the tree under root into man, in parallel. */
+int
+tree_scan(const char *root, struct Manifest *man);
+
+/* Write man out in its binary form. */
+int
+manifest_write(const struct Manifest *man, const char *filename);
+
+/* Map a manifest written by manifest_write. */
+int
+manifest_load(struct Manifest *man, const char *filename);
+
+void
+manifest_destroy(struct Manifest *man);
+
+/* Look up an entry by path relative to the root, NULL if absent. */
+const struct TreeEntry *
+manifest_find(struct Manifest *man, const char *path);
+
+/* Path of an entry, relative to the root. */
+const char *
+manifest_path(const struct Manifest *man, const struct TreeEntry *ent);
+
+/* Call fn for every entry that differs going from old to new. Directories are
+ * reported modified when anything below them changed, and everything under an
+ * added or removed directory is reported too. Matching subtrees are skipped
+ * without being looked at. */
+int
+manifest_diff(
+	const struct Manifest *old,
+	const struct Manifest *new,
+	void (*fn)(enum TreeChange change, const char *path, void *ctx),
+	void *ctx
+);
+
+#endif
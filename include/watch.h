@@ -0,0 +1,110 @@
+#ifndef INCLUDE_WATCH_H
+#define INCLUDE_WATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "table.h"
+
+/*
+ * Keep file hashes up to date by watching trees with inotify, so "what
+ * changed?" doesn't need a stat of every path. Every change bumps a sequence
+ * number; callers hold on to the last one they saw as a token and ask what
+ * changed since. Hashes are only recomputed when asked for.
+ *
+ * The same queries can be served over a Unix socket, one per line:
+ *   TOKEN           -> "TOKEN <t>"
+ *   CHANGED <t>     -> "M <path>" or "D <path>" per path, then "TOKEN <t>"
+ *   HASH <path>     -> "<hash in hex>" or "ERR"
+ */
+
+#define WATCH_MAX_CLIENTS 64
+#define WATCH_LINE_MAX 4096
+#define WATCH_OUT_BUF 65536 /* reply bytes queued ahead of a client reading */
+
+struct WatchFile {
+	char *path;
+	uint64_t hash;
+	uint64_t seq; /* of its last change, 0 if none seen */
+	int valid;    /* hash is current */
+	int exists;
+};
+
+struct WatchChange {
+	uint64_t seq;
+	struct WatchFile *file;
+};
+
+struct WatchClient {
+	int fd;
+	size_t len;
+	char buf[WATCH_LINE_MAX];
+
+	char *out; /* replies not written yet, the socket is nonblocking */
+	size_t out_len, out_cap;
+	int failed; /* couldn't queue a reply, drop it */
+
+	/* A CHANGED reply being streamed: changes up to stream_end, after
+	 * stream_seq which is the last one queued */
+	int streaming;
+	uint64_t stream_seq, stream_end;
+};
+
+struct Watch {
+	int inotify_fd;
+	int listen_fd; /* -1 unless listening */
+	uint64_t seq;
+
+	struct Table files; /* path -> struct WatchFile * */
+	struct WatchFile **all_files;
+	size_t n_files;
+
+	char **wd_paths; /* watched directory by watch descriptor */
+	size_t n_wd_paths;
+
+	char **roots; /* as given to watch_add_tree */
+	size_t n_roots;
+
+	struct WatchChange *log; /* in seq order, superseded entries pruned */
+	size_t n_log, cap_log;
+
+	struct WatchClient *clients[WATCH_MAX_CLIENTS];
+};
+
+int
+watch_init(struct Watch *w);
+
+void
+watch_destroy(struct Watch *w);
+
+/* Start watching every directory under root. Files found are known but not
+ * hashed yet, and don't count as changed. */
+int
+watch_add_tree(struct Watch *w, const char *root);
+
+/* Apply whatever inotify has queued up, without blocking. */
+int
+watch_process(struct Watch *w);
+
+/* Current hash of a watched file, rehashing only if it changed. */
+int
+watch_hash(struct Watch *w, const char *path, uint64_t *hash);
+
+/* Call fn once for every path changed after token, return the current token. */
+uint64_t
+watch_changed_since(
+	struct Watch *w,
+	uint64_t token,
+	void (*fn)(const char *path, int exists, void *ctx),
+	void *ctx
+);
+
+/* Serve queries on a Unix socket at path. */
+int
+watch_listen(struct Watch *w, const char *path);
+
+/* Wait up to timeout ms (-1 for ever) for events or queries and handle them. */
+int
+watch_poll(struct Watch *w, int timeout);
+
+#endif
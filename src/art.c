@@ -0,0 +1,869 @@
+#include "art.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Leaves are tagged pointers in the child arrays */
+#define IS_LEAF(x) ((uintptr_t)(x) & 1)
+#define SET_LEAF(x) ((struct ArtNode *)((uintptr_t)(x) | 1))
+#define LEAF_RAW(x) ((struct ArtLeaf *)((uintptr_t)(x) & ~(uintptr_t)1))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+enum ArtType { art_node4, art_node16, art_node48, art_node256 };
+
+struct ArtNode {
+	uint8_t type;
+	uint16_t n_children;
+	uint32_t prefix_len; /* may be longer than what's kept in prefix */
+	unsigned char prefix[ART_PREFIX_MAX];
+};
+
+/* Keys are kept sorted in Node4 and Node16 */
+struct ArtNode4 {
+	struct ArtNode n;
+	unsigned char keys[4];
+	struct ArtNode *children[4];
+};
+
+struct ArtNode16 {
+	struct ArtNode n;
+	unsigned char keys[16];
+	struct ArtNode *children[16];
+};
+
+struct ArtNode48 {
+	struct ArtNode n;
+	unsigned char index[256]; /* into children, plus 1, 0 if none */
+	struct ArtNode *children[48];
+};
+
+struct ArtNode256 {
+	struct ArtNode n;
+	struct ArtNode *children[256];
+};
+
+struct ArtLeaf {
+	void *val;
+	size_t len; /* including the terminator, which is part of the key so no
+	             * key is a prefix of another */
+	unsigned char key[];
+};
+
+static const size_t node_sizes[] = {
+	sizeof(struct ArtNode4),
+	sizeof(struct ArtNode16),
+	sizeof(struct ArtNode48),
+	sizeof(struct ArtNode256),
+};
+
+static struct ArtNode *
+_art_node_alloc(struct Art *t, enum ArtType type)
+{
+	struct ArtNode *n = calloc(1, node_sizes[type]);
+
+	if (!n)
+		return NULL;
+	n->type = (uint8_t)type;
+	t->n_bytes += node_sizes[type];
+	return n;
+}
+
+static void
+_art_node_free(struct Art *t, struct ArtNode *n)
+{
+	t->n_bytes -= node_sizes[n->type];
+	free(n);
+}
+
+static struct ArtLeaf *
+_art_leaf_alloc(struct Art *t, const unsigned char *key, size_t len, void *val)
+{
+	struct ArtLeaf *l = malloc(sizeof(*l) + len);
+
+	if (!l)
+		return NULL;
+	l->val = val;
+	l->len = len;
+	memcpy(l->key, key, len);
+	t->n_bytes += sizeof(*l) + len;
+	return l;
+}
+
+static void
+_art_leaf_free(struct Art *t, struct ArtLeaf *l)
+{
+	t->n_bytes -= sizeof(*l) + l->len;
+	free(l);
+}
+
+static void
+_art_destroy_node(struct Art *t, struct ArtNode *n)
+{
+	struct ArtNode **children;
+	size_t n_slots;
+
+	if (!n)
+		return;
+	if (IS_LEAF(n)) {
+		_art_leaf_free(t, LEAF_RAW(n));
+		return;
+	}
+	switch (n->type) {
+	case art_node4:
+		children = ((struct ArtNode4 *)n)->children;
+		n_slots = n->n_children;
+		break;
+	case art_node16:
+		children = ((struct ArtNode16 *)n)->children;
+		n_slots = n->n_children;
+		break;
+	case art_node48:
+		children = ((struct ArtNode48 *)n)->children;
+		n_slots = 48;
+		break;
+	default:
+		children = ((struct ArtNode256 *)n)->children;
+		n_slots = 256;
+		break;
+	}
+	for (size_t i = 0; i < n_slots; i++)
+		_art_destroy_node(t, children[i]);
+	_art_node_free(t, n);
+}
+
+int
+art_init(struct Art *t)
+{
+	t->root = NULL;
+	t->n_keys = 0;
+	t->n_bytes = 0;
+	return 0;
+}
+
+void
+art_destroy(struct Art *t)
+{
+	_art_destroy_node(t, t->root);
+	t->root = NULL;
+}
+
+/* Position of c in a Node16, or -1 */
+static int
+_art_search16(const struct ArtNode16 *p, unsigned char c)
+{
+#ifdef __SSE2__
+	const __m128i keys =
+		_mm_loadu_si128((const __m128i *)(const void *)p->keys);
+	const int mask =
+		_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8((char)c), keys)) &
+		((1 << p->n.n_children) - 1);
+
+	return mask ? __builtin_ctz((unsigned)mask) : -1;
+#else
+	for (int i = 0; i < p->n.n_children; i++)
+		if (p->keys[i] == c)
+			return i;
+	return -1;
+#endif
+}
+
+/* Where c would go among a Node16's sorted keys */
+static unsigned
+_art_lower16(const struct ArtNode16 *p, unsigned char c)
+{
+#ifdef __SSE2__
+	/* There's only a signed byte compare, so flip the sign bits first */
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	const __m128i keys = _mm_xor_si128(
+		_mm_loadu_si128((const __m128i *)(const void *)p->keys),
+		bias
+	);
+	const __m128i cc = _mm_xor_si128(_mm_set1_epi8((char)c), bias);
+	const int mask = _mm_movemask_epi8(_mm_cmplt_epi8(cc, keys)) &
+		((1 << p->n.n_children) - 1);
+
+	return mask ? (unsigned)__builtin_ctz((unsigned)mask) : p->n.n_children;
+#else
+	unsigned i = 0;
+
+	while (i < p->n.n_children && p->keys[i] < c)
+		i++;
+	return i;
+#endif
+}
+
+static struct ArtNode **
+_art_find_child(struct ArtNode *n, unsigned char c)
+{
+	switch (n->type) {
+	case art_node4: {
+		struct ArtNode4 *p = (struct ArtNode4 *)n;
+
+		for (unsigned i = 0; i < n->n_children; i++)
+			if (p->keys[i] == c)
+				return p->children + i;
+		break;
+	}
+	case art_node16: {
+		struct ArtNode16 *p = (struct ArtNode16 *)n;
+		const int i = _art_search16(p, c);
+
+		if (i != -1)
+			return p->children + i;
+		break;
+	}
+	case art_node48: {
+		struct ArtNode48 *p = (struct ArtNode48 *)n;
+
+		if (p->index[c])
+			return p->children + p->index[c] - 1;
+		break;
+	}
+	case art_node256: {
+		struct ArtNode256 *p = (struct ArtNode256 *)n;
+
+		if (p->children[c])
+			return p->children + c;
+		break;
+	}
+	}
+	return NULL;
+}
+
+/* Leftmost leaf under n */
+static struct ArtLeaf *
+_art_minimum(const struct ArtNode *n)
+{
+	while (!IS_LEAF(n)) {
+		switch (n->type) {
+		case art_node4:
+			n = ((const struct ArtNode4 *)n)->children[0];
+			break;
+		case art_node16:
+			n = ((const struct ArtNode16 *)n)->children[0];
+			break;
+		case art_node48: {
+			const struct ArtNode48 *p = (const struct ArtNode48 *)n;
+			unsigned i = 0;
+
+			while (!p->index[i])
+				i++;
+			n = p->children[p->index[i] - 1];
+			break;
+		}
+		default: {
+			const struct ArtNode256 *p = (const struct ArtNode256 *)n;
+			unsigned i = 0;
+
+			while (!p->children[i])
+				i++;
+			n = p->children[i];
+			break;
+		}
+		}
+	}
+	return LEAF_RAW(n);
+}
+
+static int
+_art_leaf_matches(
+	const struct ArtLeaf *l,
+	const unsigned char *key,
+	size_t len
+)
+{
+	return l->len == len && !memcmp(l->key, key, len);
+}
+
+/* Bytes of the stored prefix that match key from depth on */
+static size_t
+_art_check_prefix(
+	const struct ArtNode *n,
+	const unsigned char *key,
+	size_t len,
+	size_t depth
+)
+{
+	const size_t max =
+		MIN(MIN((size_t)n->prefix_len, ART_PREFIX_MAX), len - depth);
+	size_t i;
+
+	for (i = 0; i < max && n->prefix[i] == key[depth + i]; i++)
+		;
+	return i;
+}
+
+/* Bytes of the whole prefix that match key from depth on, going to a leaf
+ * for what's past ART_PREFIX_MAX */
+static size_t
+_art_prefix_mismatch(
+	const struct ArtNode *n,
+	const unsigned char *key,
+	size_t len,
+	size_t depth
+)
+{
+	size_t i = _art_check_prefix(n, key, len, depth);
+	const struct ArtLeaf *l;
+	size_t max;
+
+	if (i < ART_PREFIX_MAX || n->prefix_len <= ART_PREFIX_MAX)
+		return i;
+	l = _art_minimum(n);
+	max = MIN(MIN(l->len, len) - depth, n->prefix_len);
+	for (; i < max && l->key[depth + i] == key[depth + i]; i++)
+		;
+	return i;
+}
+
+static void
+_art_copy_header(struct ArtNode *dst, const struct ArtNode *src)
+{
+	dst->n_children = src->n_children;
+	dst->prefix_len = src->prefix_len;
+	memcpy(dst->prefix, src->prefix, MIN(src->prefix_len, ART_PREFIX_MAX));
+}
+
+/* Add child under byte c, replacing n (through ref) with a bigger node if
+ * it's full. */
+static int
+_art_add_child(
+	struct Art *t,
+	struct ArtNode *n,
+	struct ArtNode **ref,
+	unsigned char c,
+	struct ArtNode *child
+)
+{
+	switch (n->type) {
+	case art_node4: {
+		struct ArtNode4 *p = (struct ArtNode4 *)n;
+		struct ArtNode16 *big;
+		unsigned i = 0;
+
+		if (n->n_children < 4) {
+			while (i < n->n_children && p->keys[i] < c)
+				i++;
+			memmove(p->keys + i + 1, p->keys + i, n->n_children - i);
+			memmove(
+				p->children + i + 1,
+				p->children + i,
+				(n->n_children - i) * sizeof(*p->children)
+			);
+			p->keys[i] = c;
+			p->children[i] = child;
+			n->n_children++;
+			return 0;
+		}
+		big = (struct ArtNode16 *)_art_node_alloc(t, art_node16);
+		if (!big)
+			return -1;
+		_art_copy_header(&big->n, n);
+		memcpy(big->keys, p->keys, sizeof(p->keys));
+		memcpy(big->children, p->children, sizeof(p->children));
+		*ref = &big->n;
+		_art_node_free(t, n);
+		return _art_add_child(t, &big->n, ref, c, child);
+	}
+	case art_node16: {
+		struct ArtNode16 *p = (struct ArtNode16 *)n;
+		struct ArtNode48 *big;
+		unsigned i;
+
+		if (n->n_children < 16) {
+			i = _art_lower16(p, c);
+			memmove(p->keys + i + 1, p->keys + i, n->n_children - i);
+			memmove(
+				p->children + i + 1,
+				p->children + i,
+				(n->n_children - i) * sizeof(*p->children)
+			);
+			p->keys[i] = c;
+			p->children[i] = child;
+			n->n_children++;
+			return 0;
+		}
+		big = (struct ArtNode48 *)_art_node_alloc(t, art_node48);
+		if (!big)
+			return -1;
+		_art_copy_header(&big->n, n);
+		memcpy(big->children, p->children, sizeof(p->children));
+		for (i = 0; i < 16; i++)
+			big->index[p->keys[i]] = (unsigned char)(i + 1);
+		*ref = &big->n;
+		_art_node_free(t, n);
+		return _art_add_child(t, &big->n, ref, c, child);
+	}
+	case art_node48: {
+		struct ArtNode48 *p = (struct ArtNode48 *)n;
+		struct ArtNode256 *big;
+		unsigned i = 0;
+
+		if (n->n_children < 48) {
+			while (p->children[i])
+				i++;
+			p->children[i] = child;
+			p->index[c] = (unsigned char)(i + 1);
+			n->n_children++;
+			return 0;
+		}
+		big = (struct ArtNode256 *)_art_node_alloc(t, art_node256);
+		if (!big)
+			return -1;
+		_art_copy_header(&big->n, n);
+		for (i = 0; i < 256; i++)
+			if (p->index[i])
+				big->children[i] = p->children[p->index[i] - 1];
+		*ref = &big->n;
+		_art_node_free(t, n);
+		return _art_add_child(t, &big->n, ref, c, child);
+	}
+	default: {
+		struct ArtNode256 *p = (struct ArtNode256 *)n;
+
+		p->children[c] = child;
+		n->n_children++;
+		return 0;
+	}
+	}
+}
+
+static int
+_art_insert(
+	struct Art *t,
+	struct ArtNode **ref,
+	const unsigned char *key,
+	size_t len,
+	void *val,
+	size_t depth
+)
+{
+	struct ArtNode *n = *ref, *split, **child;
+	struct ArtLeaf *l, *new_leaf;
+	size_t common;
+
+	if (!n) {
+		new_leaf = _art_leaf_alloc(t, key, len, val);
+		if (!new_leaf)
+			return -1;
+		*ref = SET_LEAF(new_leaf);
+		t->n_keys++;
+		return 0;
+	}
+
+	/* Two keys under one leaf, put a Node4 over both */
+	if (IS_LEAF(n)) {
+		l = LEAF_RAW(n);
+		if (_art_leaf_matches(l, key, len)) {
+			l->val = val;
+			return 0;
+		}
+		split = _art_node_alloc(t, art_node4);
+		new_leaf = _art_leaf_alloc(t, key, len, val);
+		if (!split || !new_leaf)
+			goto cleanup_fail;
+		common = 0;
+		while (l->key[depth + common] == key[depth + common])
+			common++;
+		split->prefix_len = (uint32_t)common;
+		memcpy(split->prefix, key + depth, MIN(common, ART_PREFIX_MAX));
+		_art_add_child(t, split, ref, l->key[depth + common], n);
+		_art_add_child(t, split, ref, key[depth + common], SET_LEAF(new_leaf));
+		*ref = split;
+		t->n_keys++;
+		return 0;
+	}
+
+	/* Key leaves the node's prefix part way, split the prefix there */
+	if (n->prefix_len) {
+		common = _art_prefix_mismatch(n, key, len, depth);
+		if (common < n->prefix_len) {
+			split = _art_node_alloc(t, art_node4);
+			new_leaf = _art_leaf_alloc(t, key, len, val);
+			if (!split || !new_leaf)
+				goto cleanup_fail;
+			split->prefix_len = (uint32_t)common;
+			memcpy(split->prefix, n->prefix, MIN(common, ART_PREFIX_MAX));
+			if (n->prefix_len <= ART_PREFIX_MAX) {
+				_art_add_child(t, split, ref, n->prefix[common], n);
+				n->prefix_len -= (uint32_t)common + 1;
+				memmove(
+					n->prefix,
+					n->prefix + common + 1,
+					MIN(n->prefix_len, ART_PREFIX_MAX)
+				);
+			} else {
+				l = _art_minimum(n);
+				_art_add_child(t, split, ref, l->key[depth + common], n);
+				n->prefix_len -= (uint32_t)common + 1;
+				memcpy(
+					n->prefix,
+					l->key + depth + common + 1,
+					MIN(n->prefix_len, ART_PREFIX_MAX)
+				);
+			}
+			_art_add_child(
+				t,
+				split,
+				ref,
+				key[depth + common],
+				SET_LEAF(new_leaf)
+			);
+			*ref = split;
+			t->n_keys++;
+			return 0;
+		}
+		depth += n->prefix_len;
+	}
+
+	child = _art_find_child(n, key[depth]);
+	if (child)
+		return _art_insert(t, child, key, len, val, depth + 1);
+
+	new_leaf = _art_leaf_alloc(t, key, len, val);
+	if (!new_leaf)
+		return -1;
+	if (_art_add_child(t, n, ref, key[depth], SET_LEAF(new_leaf))) {
+		_art_leaf_free(t, new_leaf);
+		return -1;
+	}
+	t->n_keys++;
+	return 0;
+
+cleanup_fail:
+	if (split)
+		_art_node_free(t, split);
+	if (new_leaf)
+		_art_leaf_free(t, new_leaf);
+	return -1;
+}
+
+int
+art_insert(struct Art *t, const char *key, void *val)
+{
+	return _art_insert(
+		t,
+		&t->root,
+		(const unsigned char *)key,
+		strlen(key) + 1,
+		val,
+		0
+	);
+}
+
+void **
+art_find(struct Art *t, const char *key)
+{
+	const unsigned char *k = (const unsigned char *)key;
+	const size_t len = strlen(key) + 1;
+	struct ArtNode *n = t->root, **child;
+	size_t depth = 0;
+
+	while (n) {
+		if (IS_LEAF(n)) {
+			struct ArtLeaf *l = LEAF_RAW(n);
+
+			return _art_leaf_matches(l, k, len) ? &l->val : NULL;
+		}
+		if (n->prefix_len) {
+			if (_art_check_prefix(n, k, len, depth) !=
+			    MIN(n->prefix_len, ART_PREFIX_MAX))
+				return NULL;
+			depth += n->prefix_len;
+			if (depth >= len)
+				return NULL;
+		}
+		child = _art_find_child(n, k[depth]);
+		n = child ? *child : NULL;
+		depth++;
+	}
+	return NULL;
+}
+
+/* Take out the child at pos, replacing n (through ref) with a smaller node
+ * once it's sparse enough. */
+static int
+_art_remove_child(
+	struct Art *t,
+	struct ArtNode *n,
+	struct ArtNode **ref,
+	unsigned char c,
+	struct ArtNode **pos
+)
+{
+	switch (n->type) {
+	case art_node4: {
+		struct ArtNode4 *p = (struct ArtNode4 *)n;
+		const size_t i = (size_t)(pos - p->children);
+		struct ArtNode *child;
+
+		memmove(p->keys + i, p->keys + i + 1, n->n_children - 1 - i);
+		memmove(
+			p->children + i,
+			p->children + i + 1,
+			(n->n_children - 1 - i) * sizeof(*p->children)
+		);
+		n->n_children--;
+		if (n->n_children > 1)
+			return 0;
+
+		/* Only one child left, fold this node's prefix and key byte into
+		 * it and drop the node */
+		child = p->children[0];
+		if (!IS_LEAF(child)) {
+			size_t len = n->prefix_len;
+
+			if (len < ART_PREFIX_MAX)
+				n->prefix[len++] = p->keys[0];
+			if (len < ART_PREFIX_MAX) {
+				const size_t sub =
+					MIN(child->prefix_len, ART_PREFIX_MAX - len);
+
+				memcpy(n->prefix + len, child->prefix, sub);
+				len += sub;
+			}
+			memcpy(child->prefix, n->prefix, MIN(len, ART_PREFIX_MAX));
+			child->prefix_len += n->prefix_len + 1;
+		}
+		*ref = child;
+		_art_node_free(t, n);
+		return 0;
+	}
+	case art_node16: {
+		struct ArtNode16 *p = (struct ArtNode16 *)n;
+		const size_t i = (size_t)(pos - p->children);
+		struct ArtNode4 *small;
+
+		memmove(p->keys + i, p->keys + i + 1, n->n_children - 1 - i);
+		memmove(
+			p->children + i,
+			p->children + i + 1,
+			(n->n_children - 1 - i) * sizeof(*p->children)
+		);
+		n->n_children--;
+		if (n->n_children > 3)
+			return 0;
+		/* Shrinking is best effort, a big node is still a valid one */
+		small = (struct ArtNode4 *)_art_node_alloc(t, art_node4);
+		if (!small)
+			return 0;
+		_art_copy_header(&small->n, n);
+		memcpy(small->keys, p->keys, 3);
+		memcpy(small->children, p->children, 3 * sizeof(*p->children));
+		*ref = &small->n;
+		_art_node_free(t, n);
+		return 0;
+	}
+	case art_node48: {
+		struct ArtNode48 *p = (struct ArtNode48 *)n;
+		struct ArtNode16 *small;
+		unsigned j = 0;
+
+		p->children[p->index[c] - 1] = NULL;
+		p->index[c] = 0;
+		n->n_children--;
+		if (n->n_children > 12)
+			return 0;
+		small = (struct ArtNode16 *)_art_node_alloc(t, art_node16);
+		if (!small)
+			return 0;
+		_art_copy_header(&small->n, n);
+		for (unsigned i = 0; i < 256; i++) {
+			if (!p->index[i])
+				continue;
+			small->keys[j] = (unsigned char)i;
+			small->children[j++] = p->children[p->index[i] - 1];
+		}
+		*ref = &small->n;
+		_art_node_free(t, n);
+		return 0;
+	}
+	default: {
+		struct ArtNode256 *p = (struct ArtNode256 *)n;
+		struct ArtNode48 *small;
+		unsigned j = 0;
+
+		p->children[c] = NULL;
+		n->n_children--;
+		if (n->n_children > 37)
+			return 0;
+		small = (struct ArtNode48 *)_art_node_alloc(t, art_node48);
+		if (!small)
+			return 0;
+		_art_copy_header(&small->n, n);
+		for (unsigned i = 0; i < 256; i++) {
+			if (!p->children[i])
+				continue;
+			small->children[j] = p->children[i];
+			small->index[i] = (unsigned char)++j;
+		}
+		*ref = &small->n;
+		_art_node_free(t, n);
+		return 0;
+	}
+	}
+}
+
+static struct ArtLeaf *
+_art_delete(
+	struct Art *t,
+	struct ArtNode **ref,
+	const unsigned char *key,
+	size_t len,
+	size_t depth
+)
+{
+	struct ArtNode *n = *ref, **child;
+	struct ArtLeaf *l;
+
+	if (!n)
+		return NULL;
+	if (IS_LEAF(n)) {
+		l = LEAF_RAW(n);
+		if (!_art_leaf_matches(l, key, len))
+			return NULL;
+		*ref = NULL;
+		return l;
+	}
+
+	if (n->prefix_len) {
+		if (_art_check_prefix(n, key, len, depth) !=
+		    MIN(n->prefix_len, ART_PREFIX_MAX))
+			return NULL;
+		depth += n->prefix_len;
+		if (depth >= len)
+			return NULL;
+	}
+
+	child = _art_find_child(n, key[depth]);
+	if (!child)
+		return NULL;
+	if (!IS_LEAF(*child))
+		return _art_delete(t, child, key, len, depth + 1);
+	l = LEAF_RAW(*child);
+	if (!_art_leaf_matches(l, key, len))
+		return NULL;
+	_art_remove_child(t, n, ref, key[depth], child);
+	return l;
+}
+
+int
+art_delete(struct Art *t, const char *key)
+{
+	struct ArtLeaf *l = _art_delete(
+		t,
+		&t->root,
+		(const unsigned char *)key,
+		strlen(key) + 1,
+		0
+	);
+
+	if (!l)
+		return -1;
+	_art_leaf_free(t, l);
+	t->n_keys--;
+	return 0;
+}
+
+static int
+_art_iter(
+	const struct ArtNode *n,
+	int (*fn)(const char *key, void *val, void *ctx),
+	void *ctx
+)
+{
+	int ret;
+
+	if (!n)
+		return 0;
+	if (IS_LEAF(n)) {
+		struct ArtLeaf *l = LEAF_RAW(n);
+
+		return fn((const char *)l->key, l->val, ctx);
+	}
+	switch (n->type) {
+	case art_node4: {
+		const struct ArtNode4 *p = (const struct ArtNode4 *)n;
+
+		for (unsigned i = 0; i < n->n_children; i++)
+			if ((ret = _art_iter(p->children[i], fn, ctx)))
+				return ret;
+		break;
+	}
+	case art_node16: {
+		const struct ArtNode16 *p = (const struct ArtNode16 *)n;
+
+		for (unsigned i = 0; i < n->n_children; i++)
+			if ((ret = _art_iter(p->children[i], fn, ctx)))
+				return ret;
+		break;
+	}
+	case art_node48: {
+		const struct ArtNode48 *p = (const struct ArtNode48 *)n;
+
+		for (unsigned i = 0; i < 256; i++)
+			if (p->index[i] &&
+			    (ret = _art_iter(p->children[p->index[i] - 1], fn, ctx)))
+				return ret;
+		break;
+	}
+	default: {
+		const struct ArtNode256 *p = (const struct ArtNode256 *)n;
+
+		for (unsigned i = 0; i < 256; i++)
+			if ((ret = _art_iter(p->children[i], fn, ctx)))
+				return ret;
+		break;
+	}
+	}
+	return 0;
+}
+
+int
+art_prefix(
+	struct Art *t,
+	const char *prefix,
+	int (*fn)(const char *key, void *val, void *ctx),
+	void *ctx
+)
+{
+	const unsigned char *k = (const unsigned char *)prefix;
+	const size_t len = strlen(prefix);
+	struct ArtNode *n = t->root, **child;
+	struct ArtLeaf *l;
+	size_t depth = 0;
+
+	while (n) {
+		if (IS_LEAF(n)) {
+			l = LEAF_RAW(n);
+			if (l->len > len && !memcmp(l->key, k, len))
+				return fn((const char *)l->key, l->val, ctx);
+			return 0;
+		}
+		/* Everything below starts with prefix, so long as one does */
+		if (depth == len) {
+			l = _art_minimum(n);
+			if (l->len > len && !memcmp(l->key, k, len))
+				return _art_iter(n, fn, ctx);
+			return 0;
+		}
+		if (n->prefix_len) {
+			const size_t common = _art_prefix_mismatch(n, k, len, depth);
+
+			if (depth + common == len)
+				return _art_iter(n, fn, ctx);
+			if (common < n->prefix_len)
+				return 0;
+			depth += n->prefix_len;
+		}
+		child = _art_find_child(n, k[depth]);
+		n = child ? *child : NULL;
+		depth++;
+	}
+	return 0;
+}
@@ -0,0 +1,207 @@
+#include "compact.h"
+#include "hash.h"
+#include "table.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMPACT_SEED 0x9e3779b97f4a7c15U
+
+struct CompactEntry {
+	const char *key;
+	void *val;
+};
+
+static int
+_compact_cmp(const void *a, const void *b)
+{
+	return strcmp(
+		((const struct CompactEntry *)a)->key,
+		((const struct CompactEntry *)b)->key
+	);
+}
+
+/* LEB128, lengths are nearly always one byte */
+static size_t
+_varint_put(unsigned char *out, size_t x)
+{
+	size_t n = 0;
+
+	for (; x >= 0x80; x >>= 7, n++)
+		if (out)
+			out[n] = (unsigned char)(x | 0x80);
+	if (out)
+		out[n] = (unsigned char)x;
+	return n + 1;
+}
+
+static size_t
+_varint_get(const unsigned char **p)
+{
+	size_t x = 0;
+	unsigned shift = 0;
+
+	for (; **p & 0x80; (*p)++, shift += 7)
+		x |= (size_t)(**p & 0x7f) << shift;
+	x |= (size_t)*(*p)++ << shift;
+	return x;
+}
+
+/* Front code sorted entries into out, or only measure them if it's NULL */
+static size_t
+_compact_encode(
+	const struct CompactEntry *entries,
+	size_t n,
+	unsigned char *out,
+	uint32_t *blocks
+)
+{
+	size_t len = 0, prev_len = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		const char *key = entries[i].key;
+		size_t shared = 0, suffix;
+
+		if (i % COMPACT_BLOCK_KEYS) {
+			const char *prev = entries[i - 1].key;
+
+			while (shared < prev_len && key[shared] == prev[shared])
+				shared++;
+		} else if (blocks) {
+			blocks[i / COMPACT_BLOCK_KEYS] = (uint32_t)len;
+		}
+		suffix = strlen(key + shared);
+		len += _varint_put(out ? out + len : NULL, shared);
+		len += _varint_put(out ? out + len : NULL, suffix);
+		if (out)
+			memcpy(out + len, key + shared, suffix);
+		len += suffix;
+		prev_len = shared + suffix;
+	}
+	return len;
+}
+
+/* Whether the key of the given rank is key, which is len bytes long. Keys in
+ * the block are decoded one after the other, only keeping track of how much
+ * of key the current one matches: if a key shares more with the one before
+ * than that, it differs from key at the same place. */
+static int
+_compact_match(
+	const struct CompactTable *c,
+	size_t rank,
+	const char *key,
+	size_t len
+)
+{
+	const unsigned char *p = c->keys + c->blocks[rank / COMPACT_BLOCK_KEYS];
+	size_t match = 0;
+
+	for (size_t i = rank % COMPACT_BLOCK_KEYS;; i--) {
+		const size_t shared = _varint_get(&p);
+		const size_t suffix = _varint_get(&p);
+
+		if (shared <= match) {
+			match = shared;
+			while (match < shared + suffix && match < len &&
+			       p[match - shared] == (unsigned char)key[match])
+				match++;
+		}
+		if (!i)
+			return match == len && shared + suffix == len;
+		p += suffix;
+	}
+}
+
+static size_t
+_compact_slot(const struct CompactTable *c, uint64_t h)
+{
+	return (size_t)((uint64_t)(uint32_t)h * c->n_slots >> 32);
+}
+
+int
+table_compact(const struct Table *tbl, struct CompactTable *c)
+{
+	struct CompactEntry *entries;
+	size_t n_blocks;
+
+	memset(c, 0, sizeof(*c));
+	c->n = tbl->n_filled;
+	/* Ranks are 32-bit, and so must slot indices be, see _compact_slot */
+	if (c->n > UINT32_MAX / 2)
+		return -1;
+	entries = malloc((c->n ? c->n : 1) * sizeof(*entries));
+	if (!entries)
+		return -1;
+	for (size_t i = 0, j = 0; j < c->n; j++)
+		table_next(tbl, &i, &entries[j].key, &entries[j].val);
+	qsort(entries, c->n, sizeof(*entries), _compact_cmp);
+
+	c->keys_len = _compact_encode(entries, c->n, NULL, NULL);
+	if (c->keys_len > UINT32_MAX)
+		goto cleanup_fail;
+	n_blocks = (c->n + COMPACT_BLOCK_KEYS - 1) / COMPACT_BLOCK_KEYS;
+	/* There's always an empty slot to stop at */
+	c->n_slots = c->n * 100 / COMPACT_LOAD + 1;
+	c->slots = calloc(c->n_slots, sizeof(*c->slots));
+	c->vals = malloc((c->n ? c->n : 1) * sizeof(*c->vals));
+	c->blocks = malloc((n_blocks ? n_blocks : 1) * sizeof(*c->blocks));
+	c->keys = malloc(c->keys_len ? c->keys_len : 1);
+	if (!c->slots || !c->vals || !c->blocks || !c->keys)
+		goto cleanup_fail;
+	c->n_bytes = c->n_slots * sizeof(*c->slots) + c->n * sizeof(*c->vals) +
+		n_blocks * sizeof(*c->blocks) + c->keys_len;
+	_compact_encode(entries, c->n, c->keys, c->blocks);
+
+	for (size_t i = 0; i < c->n; i++) {
+		const uint64_t h =
+			fnv1a_64((const unsigned char *)entries[i].key, COMPACT_SEED);
+		size_t slot = _compact_slot(c, h);
+
+		while (c->slots[slot].rank)
+			slot = slot + 1 == c->n_slots ? 0 : slot + 1;
+		c->slots[slot].tag = (uint32_t)(h >> 32);
+		c->slots[slot].rank = (uint32_t)(i + 1);
+		c->vals[i] = entries[i].val;
+	}
+	free(entries);
+	return 0;
+
+cleanup_fail:
+	free(entries);
+	compact_destroy(c);
+	return -1;
+}
+
+void
+compact_destroy(struct CompactTable *c)
+{
+	free(c->slots);
+	free(c->vals);
+	free(c->blocks);
+	free(c->keys);
+	c->slots = NULL;
+	c->vals = NULL;
+	c->blocks = NULL;
+	c->keys = NULL;
+}
+
+void **
+compact_find(const struct CompactTable *c, const char *key)
+{
+	const uint64_t h = fnv1a_64((const unsigned char *)key, COMPACT_SEED);
+	const uint32_t tag = (uint32_t)(h >> 32);
+	size_t slot = _compact_slot(c, h), len = SIZE_MAX;
+
+	for (; c->slots[slot].rank; slot = slot + 1 == c->n_slots ? 0 : slot + 1) {
+		const size_t rank = c->slots[slot].rank - 1;
+
+		if (c->slots[slot].tag != tag)
+			continue;
+		if (len == SIZE_MAX)
+			len = strlen(key);
+		if (_compact_match(c, rank, key, len))
+			return c->vals + rank;
+	}
+	return NULL;
+}
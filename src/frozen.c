@@ -0,0 +1,517 @@
+#include "frozen.h"
+#include "hash.h"
+#include "table.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FROZEN_MAGIC 0x31657a6f72667462 /* "btfroze1" */
+#define FROZEN_SEED 0x9e3779b97f4a7c15U
+#define SKEW_KEYS 2576980377U /* 60% of 2^32, see _frozen_bucket */
+
+struct FrozenHeader {
+	uint64_t magic;
+	uint64_t n;
+	uint64_t n_parts;
+	uint64_t n_pilots;
+	uint64_t seed;
+	uint64_t keys_len;
+};
+
+/* Shared by the threads of one build */
+struct Freeze {
+	size_t n;
+	size_t n_parts;
+	const char **keys;
+	uint64_t *hashes;
+	size_t *order;      /* key indices, grouped by partition */
+	size_t *slot_keys;  /* slot -> key index */
+	struct FrozenPart *parts;
+	uint32_t *pilots;
+	uint64_t seed;
+	unsigned n_threads;
+	int failed;
+	pthread_mutex_t lock;
+};
+
+struct FreezeThread {
+	struct Freeze *fz;
+	unsigned i;
+};
+
+/* PTHash's skew: 60% of keys go to the first 30% of buckets, which get
+ * their pilots while there's still plenty of room. */
+static uint32_t
+_frozen_bucket(uint32_t h, uint32_t n_buckets)
+{
+	const uint32_t dense = n_buckets * 3 / 10;
+
+	if (!dense)
+		return (uint32_t)((uint64_t)h * n_buckets >> 32);
+	if (h < SKEW_KEYS)
+		return (uint32_t)((uint64_t)h * dense / SKEW_KEYS);
+	return dense +
+		(uint32_t)((uint64_t)(h - SKEW_KEYS) * (n_buckets - dense) /
+	               ((1ULL << 32) - SKEW_KEYS));
+}
+
+static uint32_t
+_frozen_pos(uint64_t h, uint32_t pilot, uint32_t n)
+{
+	h ^= pilot * 0x9e3779b97f4a7c15U;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdU;
+	h ^= h >> 33;
+	return (uint32_t)(h % n);
+}
+
+/* High half of the hash picks the partition, the low half the bucket */
+static size_t
+_frozen_part(size_t n_parts, uint64_t h)
+{
+	return (size_t)((h >> 32) * n_parts >> 32);
+}
+
+static size_t
+_frozen_block_size(size_t n, size_t n_parts, size_t n_pilots, size_t keys_len)
+{
+	return sizeof(struct FrozenHeader) + n_parts * sizeof(struct FrozenPart) +
+		n * sizeof(uint64_t) + n_pilots * sizeof(uint32_t) +
+		n * sizeof(uint32_t) + keys_len;
+}
+
+/* Point f's arrays into its block, given the counts */
+static void
+_frozen_layout(struct FrozenTable *f)
+{
+	char *p = (char *)f->map + sizeof(struct FrozenHeader);
+
+	f->parts = (const struct FrozenPart *)(void *)p;
+	p += f->n_parts * sizeof(*f->parts);
+	f->vals = (const uint64_t *)(void *)p;
+	p += f->n * sizeof(*f->vals);
+	f->pilots = (const uint32_t *)(void *)p;
+	p += f->n_pilots * sizeof(*f->pilots);
+	f->offsets = (const uint32_t *)(void *)p;
+	p += f->n * sizeof(*f->offsets);
+	f->keys = p;
+}
+
+/* Find pilots for one partition, and where each of its keys goes */
+static int
+_frozen_build_part(struct Freeze *fz, const struct FrozenPart *part)
+{
+	const size_t *order = fz->order + part->base;
+	uint32_t *pilots = fz->pilots + part->pilot_base;
+	uint32_t *bucket_of = NULL, *start = NULL, *members = NULL;
+	uint32_t *by_size = NULL, *n_of_size = NULL, max_size = 0;
+	uint32_t pos[256];
+	unsigned char *taken = NULL;
+	int ret = -1;
+
+	if (!part->n)
+		return 0;
+	bucket_of = malloc(part->n * sizeof(*bucket_of));
+	start = calloc(part->n_buckets + 1, sizeof(*start));
+	members = malloc(part->n * sizeof(*members));
+	by_size = malloc(part->n_buckets * sizeof(*by_size));
+	taken = calloc(part->n, sizeof(*taken));
+	if (!bucket_of || !start || !members || !by_size || !taken)
+		goto cleanup;
+
+	/* Group keys by bucket */
+	for (uint32_t i = 0; i < part->n; i++) {
+		const uint32_t h = (uint32_t)fz->hashes[order[i]];
+
+		bucket_of[i] = _frozen_bucket(h, part->n_buckets);
+		start[bucket_of[i] + 1]++;
+	}
+	for (uint32_t b = 0; b < part->n_buckets; b++) {
+		if (start[b + 1] > max_size)
+			max_size = start[b + 1];
+		start[b + 1] += start[b];
+	}
+	/* A bucket that big means a broken hash, or identical ones */
+	if (max_size > sizeof(pos) / sizeof(*pos))
+		goto cleanup;
+	for (uint32_t i = 0; i < part->n; i++)
+		members[start[bucket_of[i]]++] = i;
+	for (uint32_t b = part->n_buckets; b > 0; b--)
+		start[b] = start[b - 1];
+	start[0] = 0;
+
+	/* Biggest buckets first */
+	n_of_size = calloc(max_size + 2, sizeof(*n_of_size));
+	if (!n_of_size)
+		goto cleanup;
+	for (uint32_t b = 0; b < part->n_buckets; b++)
+		n_of_size[max_size - (start[b + 1] - start[b]) + 1]++;
+	for (uint32_t s = 0; s <= max_size; s++)
+		n_of_size[s + 1] += n_of_size[s];
+	for (uint32_t b = 0; b < part->n_buckets; b++)
+		by_size[n_of_size[max_size - (start[b + 1] - start[b])]++] = b;
+
+	for (uint32_t i = 0; i < part->n_buckets; i++) {
+		const uint32_t b = by_size[i];
+		const uint32_t size = start[b + 1] - start[b];
+		uint32_t pilot, j;
+
+		for (pilot = 0; pilot < FROZEN_PILOT_MAX; pilot++) {
+			for (j = 0; j < size; j++) {
+				const uint64_t h = fz->hashes[order[members[start[b] + j]]];
+
+				pos[j] = _frozen_pos(h, pilot, part->n);
+				if (taken[pos[j]])
+					break;
+				taken[pos[j]] = 1;
+			}
+			if (j == size)
+				break;
+			while (j--)
+				taken[pos[j]] = 0;
+		}
+		if (pilot == FROZEN_PILOT_MAX)
+			goto cleanup;
+		pilots[b] = pilot;
+		for (j = 0; j < size; j++)
+			fz->slot_keys[part->base + pos[j]] = order[members[start[b] + j]];
+	}
+	ret = 0;
+
+cleanup:
+	free(n_of_size);
+	free(taken);
+	free(by_size);
+	free(members);
+	free(start);
+	free(bucket_of);
+	return ret;
+}
+
+static void *
+_frozen_hash_worker(void *arg)
+{
+	struct FreezeThread *t = arg;
+	struct Freeze *fz = t->fz;
+	const size_t lo = fz->n * t->i / fz->n_threads;
+	const size_t hi = fz->n * (t->i + 1) / fz->n_threads;
+
+	for (size_t i = lo; i < hi; i++)
+		fz->hashes[i] =
+			fnv1a_64((const unsigned char *)fz->keys[i], fz->seed);
+	return NULL;
+}
+
+static void *
+_frozen_part_worker(void *arg)
+{
+	struct FreezeThread *t = arg;
+	struct Freeze *fz = t->fz;
+
+	for (size_t p = t->i; p < fz->n_parts; p += fz->n_threads) {
+		if (fz->failed)
+			break;
+		if (_frozen_build_part(fz, fz->parts + p)) {
+			pthread_mutex_lock(&fz->lock);
+			fz->failed = 1;
+			pthread_mutex_unlock(&fz->lock);
+		}
+	}
+	return NULL;
+}
+
+/* Run fn on every thread slot, inline for any that couldn't be started */
+static void
+_frozen_parallel(struct Freeze *fz, void *(*fn)(void *))
+{
+	pthread_t threads[FROZEN_THREADS];
+	struct FreezeThread args[FROZEN_THREADS];
+	int started[FROZEN_THREADS];
+
+	for (unsigned i = 0; i < fz->n_threads; i++) {
+		args[i].fz = fz;
+		args[i].i = i;
+		started[i] = !pthread_create(threads + i, NULL, fn, args + i);
+	}
+	for (unsigned i = 0; i < fz->n_threads; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			fn(args + i);
+	}
+}
+
+/* Partition the hashed keys and lay out partitions and pilots */
+static int
+_frozen_partition(struct Freeze *fz)
+{
+	size_t *fill;
+	uint64_t base = 0, pilot_base = 0;
+
+	fill = calloc(fz->n_parts, sizeof(*fill));
+	if (!fill)
+		return -1;
+	memset(fz->parts, 0, fz->n_parts * sizeof(*fz->parts));
+	for (size_t i = 0; i < fz->n; i++)
+		fz->parts[_frozen_part(fz->n_parts, fz->hashes[i])].n++;
+	for (size_t p = 0; p < fz->n_parts; p++) {
+		struct FrozenPart *part = fz->parts + p;
+		uint32_t lg = 1;
+
+		while (lg < 32 && (1U << lg) < part->n)
+			lg++;
+		part->base = base;
+		part->pilot_base = pilot_base;
+		part->n_buckets =
+			part->n ? (FROZEN_BUCKET_C * part->n + lg - 1) / lg : 0;
+		base += part->n;
+		pilot_base += part->n_buckets;
+	}
+	for (size_t i = 0; i < fz->n; i++) {
+		const size_t p = _frozen_part(fz->n_parts, fz->hashes[i]);
+
+		fz->order[fz->parts[p].base + fill[p]++] = i;
+	}
+	free(fill);
+	return 0;
+}
+
+int
+table_freeze(const struct Table *tbl, struct FrozenTable *f)
+{
+	struct Freeze fz;
+	struct FrozenHeader hdr;
+	void **vals = NULL;
+	size_t keys_len = 0, n_pilots = 0;
+	uint64_t *vals_out;
+	uint32_t *offsets_out;
+	char *key_out;
+	int ret = -1;
+
+	memset(f, 0, sizeof(*f));
+	memset(&fz, 0, sizeof(fz));
+	fz.n = tbl->n_filled;
+	fz.n_parts = fz.n / FROZEN_PART_KEYS ? fz.n / FROZEN_PART_KEYS : 1;
+	fz.n_threads = FROZEN_THREADS;
+	if (pthread_mutex_init(&fz.lock, NULL))
+		return -1;
+
+	fz.keys = malloc((fz.n ? fz.n : 1) * sizeof(*fz.keys));
+	vals = malloc((fz.n ? fz.n : 1) * sizeof(*vals));
+	fz.hashes = malloc((fz.n ? fz.n : 1) * sizeof(*fz.hashes));
+	fz.order = malloc((fz.n ? fz.n : 1) * sizeof(*fz.order));
+	fz.slot_keys = malloc((fz.n ? fz.n : 1) * sizeof(*fz.slot_keys));
+	fz.parts = malloc(fz.n_parts * sizeof(*fz.parts));
+	if (!fz.keys || !vals || !fz.hashes || !fz.order || !fz.slot_keys ||
+	    !fz.parts)
+		goto cleanup;
+	for (size_t i = 0, j = 0; table_next(tbl, &i, fz.keys + j, vals + j); j++)
+		keys_len += strlen(fz.keys[j]) + 1;
+	if (keys_len > UINT32_MAX)
+		goto cleanup;
+
+	/* Identical 64-bit hashes can't be told apart by any pilot, so a
+	 * partition that can't be placed gets another go with a new seed */
+	for (unsigned attempt = 0; attempt < FROZEN_SEEDS; attempt++) {
+		fz.seed = FROZEN_SEED * (attempt + 1);
+		fz.failed = 0;
+		_frozen_parallel(&fz, _frozen_hash_worker);
+		if (_frozen_partition(&fz))
+			goto cleanup;
+		n_pilots = 0;
+		for (size_t p = 0; p < fz.n_parts; p++)
+			n_pilots += fz.parts[p].n_buckets;
+		free(fz.pilots);
+		fz.pilots = malloc((n_pilots ? n_pilots : 1) * sizeof(*fz.pilots));
+		if (!fz.pilots)
+			goto cleanup;
+		_frozen_parallel(&fz, _frozen_part_worker);
+		if (!fz.failed)
+			break;
+	}
+	if (fz.failed)
+		goto cleanup;
+
+	f->n = fz.n;
+	f->n_parts = fz.n_parts;
+	f->n_pilots = n_pilots;
+	f->seed = fz.seed;
+	f->keys_len = keys_len;
+	f->map_len = _frozen_block_size(f->n, f->n_parts, n_pilots, keys_len);
+	f->map = malloc(f->map_len);
+	if (!f->map)
+		goto cleanup;
+	_frozen_layout(f);
+
+	hdr.magic = FROZEN_MAGIC;
+	hdr.n = f->n;
+	hdr.n_parts = f->n_parts;
+	hdr.n_pilots = f->n_pilots;
+	hdr.seed = f->seed;
+	hdr.keys_len = f->keys_len;
+	memcpy(f->map, &hdr, sizeof(hdr));
+	/* The block is ours to fill, it's only const to everyone else */
+	memcpy(
+		(void *)(uintptr_t)f->parts,
+		fz.parts,
+		f->n_parts * sizeof(*f->parts)
+	);
+	memcpy(
+		(void *)(uintptr_t)f->pilots,
+		fz.pilots,
+		n_pilots * sizeof(*f->pilots)
+	);
+	vals_out = (uint64_t *)(uintptr_t)f->vals;
+	offsets_out = (uint32_t *)(uintptr_t)f->offsets;
+	key_out = (char *)(uintptr_t)f->keys;
+	for (size_t s = 0; s < f->n; s++) {
+		const size_t i = fz.slot_keys[s];
+		const size_t len = strlen(fz.keys[i]) + 1;
+
+		vals_out[s] = (uint64_t)(uintptr_t)vals[i];
+		offsets_out[s] = (uint32_t)(key_out - f->keys);
+		memcpy(key_out, fz.keys[i], len);
+		key_out += len;
+	}
+	ret = 0;
+
+cleanup:
+	pthread_mutex_destroy(&fz.lock);
+	free(fz.pilots);
+	free(fz.parts);
+	free(fz.slot_keys);
+	free(fz.order);
+	free(fz.hashes);
+	free(vals);
+	free(fz.keys);
+	return ret;
+}
+
+void
+frozen_destroy(struct FrozenTable *f)
+{
+	if (f->mapped)
+		munmap(f->map, f->map_len);
+	else
+		free(f->map);
+	f->map = NULL;
+}
+
+int
+frozen_find(const struct FrozenTable *f, const char *key, void **val)
+{
+	const uint64_t h = fnv1a_64((const unsigned char *)key, f->seed);
+	const struct FrozenPart *part = f->parts + _frozen_part(f->n_parts, h);
+	uint64_t slot;
+	uint32_t pilot;
+
+	if (!part->n)
+		return -1;
+	pilot = f->pilots[
+		part->pilot_base + _frozen_bucket((uint32_t)h, part->n_buckets)
+	];
+	slot = part->base + _frozen_pos(h, pilot, part->n);
+	if (strcmp(f->keys + f->offsets[slot], key))
+		return -1;
+	*val = (void *)(uintptr_t)f->vals[slot];
+	return 0;
+}
+
+int
+frozen_write(const struct FrozenTable *f, const char *filename)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -1;
+	for (size_t off = 0; off < f->map_len; off += (size_t)n) {
+		n = write(fd, (const char *)f->map + off, f->map_len - off);
+		if (n == -1)
+			goto cleanup_fail;
+	}
+	return close(fd);
+
+cleanup_fail:
+	close(fd);
+	return -1;
+}
+
+int
+frozen_load(struct FrozenTable *f, const char *filename)
+{
+	struct FrozenHeader hdr;
+	struct stat sb;
+	int fd;
+
+	memset(f, 0, sizeof(*f));
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &sb) || (size_t)sb.st_size < sizeof(hdr))
+		goto cleanup_fail;
+
+	f->map_len = (size_t)sb.st_size;
+	f->map = mmap(NULL, f->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (f->map == MAP_FAILED) {
+		f->map = NULL;
+		goto cleanup_fail;
+	}
+	f->mapped = 1;
+	close(fd);
+	fd = -1;
+
+	/* Don't trust anything in there, and bound every count by what would fit
+	 * in the file before multiplying */
+	memcpy(&hdr, f->map, sizeof(hdr));
+	if (hdr.magic != FROZEN_MAGIC || !hdr.n_parts ||
+	    hdr.n_parts > f->map_len / sizeof(struct FrozenPart) ||
+	    hdr.n > f->map_len / (sizeof(uint64_t) + sizeof(uint32_t)) ||
+	    hdr.n_pilots > f->map_len / sizeof(uint32_t) ||
+	    hdr.n > UINT32_MAX * hdr.n_parts || hdr.keys_len > UINT32_MAX ||
+	    (hdr.n && !hdr.keys_len) ||
+	    f->map_len != _frozen_block_size(
+			(size_t)hdr.n,
+			(size_t)hdr.n_parts,
+			(size_t)hdr.n_pilots,
+			(size_t)hdr.keys_len
+		))
+		goto cleanup_fail;
+	f->n = (size_t)hdr.n;
+	f->n_parts = (size_t)hdr.n_parts;
+	f->n_pilots = (size_t)hdr.n_pilots;
+	f->seed = hdr.seed;
+	f->keys_len = (size_t)hdr.keys_len;
+	_frozen_layout(f);
+
+	for (size_t p = 0; p < f->n_parts; p++) {
+		const struct FrozenPart *part = f->parts + p;
+
+		if (part->base + part->n > f->n ||
+		    part->pilot_base + part->n_buckets > f->n_pilots ||
+		    (part->n && !part->n_buckets))
+			goto cleanup_fail;
+	}
+	if (f->keys_len && f->keys[f->keys_len - 1])
+		goto cleanup_fail;
+	for (size_t s = 0; s < f->n; s++)
+		if (f->offsets[s] >= f->keys_len)
+			goto cleanup_fail;
+	return 0;
+
+cleanup_fail:
+	if (fd != -1)
+		close(fd);
+	if (f->map)
+		munmap(f->map, f->map_len);
+	f->map = NULL;
+	return -1;
+}
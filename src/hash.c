@@ -19,37 +19,85 @@ djb2(const unsigned char *str)
 	return hash;
 }
 
+/* FNV's low bits are weak, the murmur3 finaliser spreads them */
+static uint64_t
+fmix64(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdU;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53U;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+uint64_t
+fnv1a_64(const unsigned char *str, uint64_t seed)
+{
+	uint64_t hash = 0xcbf29ce484222325U ^ seed;
+	unsigned char c;
+
+	while ((c = *str++)) {
+		hash ^= c;
+		hash *= 0x100000001b3U;
+	}
+	return fmix64(hash);
+}
+
+uint64_t
+fnv1a_64_len(const unsigned char *buf, size_t len, uint64_t seed)
+{
+	uint64_t hash = 0xcbf29ce484222325U ^ seed;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= buf[i];
+		hash *= 0x100000001b3U;
+	}
+	return fmix64(hash ^ len);
+}
+
 int
-hash_file(char *filename, uint64_t *hash)
+hash_fd(int fd, uint64_t *hash)
 {
-	int fd = -1;
 	struct stat sb;
 	unsigned char *buf = NULL;
+	size_t off;
+	ssize_t n;
 
-	fd = open(filename, O_RDONLY);
-	if (fd == -1)
-		goto cleanup_fail;
 	if (fstat(fd, &sb))
 		goto cleanup_fail;
 
-	buf = malloc((size_t)sb.st_size + 1);
+	buf = malloc((size_t)sb.st_size ? (size_t)sb.st_size : 1);
 	if (!buf)
 		goto cleanup_fail;
-	if ((read(fd, buf, (size_t)sb.st_size)) == -1)
-		goto cleanup_fail;
-	buf[sb.st_size] = '\0';
+	for (off = 0; off < (size_t)sb.st_size; off += (size_t)n) {
+		n = read(fd, buf + off, (size_t)sb.st_size - off);
+		if (n == -1)
+			goto cleanup_fail;
+		if (n == 0)
+			break;
+	}
 
-	/* Pack the file size into the first 32 bits */
-	*hash = 0;
-	*hash = djb2(buf); /* TODO what the fuck this is a shit hash */
-	*hash |= ((uint64_t)sb.st_size << 32);
+	/* Every byte counts, binary files are full of NULs */
+	*hash = fnv1a_64_len(buf, off, 0);
 
 	free(buf);
-	close(fd);
 	return 0;
 
 cleanup_fail:
 	free(buf);
-	close(fd);
 	return -1;
 }
+
+int
+hash_file(char *filename, uint64_t *hash)
+{
+	int fd, ret;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	ret = hash_fd(fd, hash);
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,112 @@
+#include "intern.h"
+#include "table.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int
+intern_init(struct Intern *in)
+{
+	memset(in, 0, sizeof(*in));
+	if (table_init(&in->index))
+		return -1;
+	in->index.borrow_keys = 1;
+	in->strs = malloc(INTERN_INIT_IDS * sizeof(*in->strs));
+	if (!in->strs)
+		goto cleanup_fail;
+	in->cap_strs = INTERN_INIT_IDS;
+	return 0;
+
+cleanup_fail:
+	table_destroy(&in->index);
+	return -1;
+}
+
+void
+intern_destroy(struct Intern *in)
+{
+	struct InternPage *page, *next;
+
+	for (page = in->page; page; page = next) {
+		next = page->next;
+		free(page);
+	}
+	free(in->strs);
+	table_destroy(&in->index);
+}
+
+/* Copy len bytes of str into the pool, starting a new page if it won't fit */
+static char *
+intern_copy(struct Intern *in, const char *str, size_t len)
+{
+	struct InternPage *page = in->page;
+	char *p;
+
+	if (!page || page->size - page->used < len) {
+		size_t size = len > INTERN_PAGE_SIZE ? len : INTERN_PAGE_SIZE;
+
+		page = malloc(sizeof(*page) + size);
+		if (!page)
+			return NULL;
+		page->size = size;
+		page->used = 0;
+		/* An oversized string gets a page to itself, keep filling the
+		 * current one */
+		if (in->page && size > INTERN_PAGE_SIZE) {
+			page->next = in->page->next;
+			in->page->next = page;
+		} else {
+			page->next = in->page;
+			in->page = page;
+		}
+	}
+	p = page->data + page->used;
+	memcpy(p, str, len);
+	page->used += len;
+	return p;
+}
+
+int
+intern(struct Intern *in, const char *str, uint32_t *id)
+{
+	char *p;
+
+	if (!intern_find(in, str, id))
+		return 0;
+	if (in->n_strs == UINT32_MAX)
+		return -1;
+
+	if (in->n_strs == in->cap_strs) {
+		uint32_t cap = in->cap_strs > UINT32_MAX / 2 ? UINT32_MAX
+		                                             : 2 * in->cap_strs;
+		char **strs = realloc(in->strs, cap * sizeof(*strs));
+
+		if (!strs)
+			return -1;
+		in->strs = strs;
+		in->cap_strs = cap;
+	}
+
+	/* Pages aren't freed until the pool is, so a failed insert just leaves
+	 * some dead bytes behind */
+	p = intern_copy(in, str, strlen(str) + 1);
+	if (!p)
+		return -1;
+	if (table_insert(&in->index, p, (void *)(uintptr_t)(in->n_strs + 1)))
+		return -1;
+	in->strs[in->n_strs] = p;
+	*id = in->n_strs++;
+	return 0;
+}
+
+int
+intern_find(struct Intern *in, const char *str, uint32_t *id)
+{
+	void **val = table_find(&in->index, str);
+
+	if (!val)
+		return -1;
+	*id = (uint32_t)((uintptr_t)*val - 1);
+	return 0;
+}
@@ -1,18 +1,246 @@
 #include "hash.h"
 #include "table.h"
 
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define HUGE_2M ((size_t)1 << 21)
+#define HUGE_1G ((size_t)1 << 30)
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define MPOL_PREFERRED 1 /* from <numaif.h>, which is libnuma's */
+#define NUMA_NODES_MAX 1024
+
+static void *
+_table_calloc(void *ctx, size_t size)
+{
+	return calloc(1, size);
+}
+
+static void
+_table_free(void *ctx, void *ptr, size_t size)
+{
+	free(ptr);
+}
+
+const struct TableAlloc table_alloc_malloc = {_table_calloc, _table_free, NULL};
+
+/* Page size the mmap backend uses for a mapping of size bytes. Worked out the
+ * same way on free, so nothing needs to be stored alongside. */
+static size_t
+_table_map_unit(unsigned flags, size_t size)
+{
+	if (flags & TABLE_ALLOC_HUGE_1G && size >= HUGE_1G)
+		return HUGE_1G;
+	if (flags & (TABLE_ALLOC_HUGE_1G | TABLE_ALLOC_HUGE_2M) && size >= HUGE_2M)
+		return HUGE_2M;
+	return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void *
+_table_map(void *ctx, size_t size)
+{
+	const unsigned flags = (unsigned)(uintptr_t)ctx;
+	const size_t unit = _table_map_unit(flags, size);
+	const size_t len = (size + unit - 1) & ~(unit - 1);
+	char *p = MAP_FAILED;
+
+	if (unit == HUGE_1G)
+		p = mmap(
+			NULL,
+			len,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | 30 << MAP_HUGE_SHIFT,
+			-1,
+			0
+		);
+	if (p == MAP_FAILED && unit >= HUGE_2M) {
+		/* Over-map so the range can be trimmed to a 2M boundary, THP can't
+		 * back it otherwise */
+		size_t head;
+
+		p = mmap(
+			NULL,
+			len + HUGE_2M,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS,
+			-1,
+			0
+		);
+		if (p == MAP_FAILED)
+			return NULL;
+		head = (HUGE_2M - (uintptr_t)p % HUGE_2M) % HUGE_2M;
+		if (head)
+			munmap(p, head);
+		munmap(p + head + len, HUGE_2M - head);
+		p += head;
+		madvise(p, len, MADV_HUGEPAGE);
+	} else if (p == MAP_FAILED) {
+		p = mmap(
+			NULL,
+			len,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS,
+			-1,
+			0
+		);
+		if (p == MAP_FAILED)
+			return NULL;
+	}
+
+	/* Nothing is touched yet, so the policy decides where every page goes */
+	if (flags & TABLE_ALLOC_NUMA_LOCAL) {
+		unsigned cpu, node;
+		unsigned long mask[NUMA_NODES_MAX / (CHAR_BIT * sizeof(long))] = {0};
+
+		if (!syscall(SYS_getcpu, &cpu, &node, NULL) && node < NUMA_NODES_MAX) {
+			mask[node / (CHAR_BIT * sizeof(long))] |=
+				1UL << node % (CHAR_BIT * sizeof(long));
+			syscall(
+				SYS_mbind,
+				p,
+				len,
+				MPOL_PREFERRED,
+				mask,
+				NUMA_NODES_MAX + 1,
+				0
+			);
+		}
+	}
+	return p;
+}
+
+static void
+_table_unmap(void *ctx, void *ptr, size_t size)
+{
+	const size_t unit = _table_map_unit((unsigned)(uintptr_t)ctx, size);
+
+	munmap(ptr, (size + unit - 1) & ~(unit - 1));
+}
+
+void
+table_alloc_mmap(struct TableAlloc *alloc, unsigned flags)
+{
+	alloc->alloc = _table_map;
+	alloc->free = _table_unmap;
+	alloc->ctx = (void *)(uintptr_t)flags;
+}
+
+/* Blocks for a filter with ratio counters per slot */
+static size_t
+_filter_n_blocks(size_t n_slots, unsigned ratio)
+{
+	const size_t want = n_slots * ratio / (TABLE_FILTER_BLOCK * 16);
+	size_t n = 1;
+
+	while (n < want)
+		n <<= 1;
+	return n;
+}
+
+/* djb2 is weak in its low bits, so spread it before picking counters */
+static uint64_t
+_filter_mix(uint32_t hash)
+{
+	uint64_t h = hash;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdU;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53U;
+	h ^= h >> 33;
+	return h;
+}
+
+/* The high half picks the block, the low bits step through k distinct
+ * counters in it (the stride is odd, the block 128 counters). */
+static void
+_filter_update(
+	uint64_t *filter,
+	size_t n_blocks,
+	unsigned k,
+	uint32_t hash,
+	int add
+)
+{
+	const uint64_t h = _filter_mix(hash);
+	uint64_t *block = filter + (h >> 32 & (n_blocks - 1)) * TABLE_FILTER_BLOCK;
+	const unsigned a = h & 127, b = (h >> 7 & 127) | 1;
+
+	for (unsigned i = 0; i < k; i++) {
+		const unsigned c = (a + i * b) & 127;
+		const unsigned shift = (c & 15) * 4;
+		const uint64_t n = block[c >> 4] >> shift & 15;
+
+		/* Saturated counters don't know their count any more */
+		if (n == 15)
+			continue;
+		if (add)
+			block[c >> 4] += (uint64_t)1 << shift;
+		else if (n)
+			block[c >> 4] -= (uint64_t)1 << shift;
+	}
+}
+
+static int
+_filter_test(const struct Table *tbl, uint32_t hash)
+{
+	const uint64_t h = _filter_mix(hash);
+	const size_t i_block = h >> 32 & (tbl->n_filter_blocks - 1);
+	const uint64_t *block = tbl->filter + i_block * TABLE_FILTER_BLOCK;
+	const unsigned a = h & 127, b = (h >> 7 & 127) | 1;
+
+	for (unsigned i = 0; i < tbl->filter_k; i++) {
+		const unsigned c = (a + i * b) & 127;
+
+		if (!(block[c >> 4] >> (c & 15) * 4 & 15))
+			return 0;
+	}
+	return 1;
+}
+
+static void
+_filter_free(struct Table *tbl)
+{
+	if (!tbl->filter)
+		return;
+	tbl->alloc.free(
+		tbl->alloc.ctx,
+		tbl->filter,
+		tbl->n_filter_blocks * TABLE_FILTER_BLOCK * sizeof(*tbl->filter)
+	);
+	tbl->filter = NULL;
+}
 
 int
 table_init(struct Table *tbl)
+{
+	return table_init_alloc(tbl, &table_alloc_malloc);
+}
+
+int
+table_init_alloc(struct Table *tbl, const struct TableAlloc *alloc)
 {
 	tbl->n_slots = TABLE_INIT_SLOTS;
 	tbl->n_filled = 0;
 	tbl->n_tomb = 0;
-	tbl->slots = calloc(2 * TABLE_INIT_SLOTS, sizeof(*tbl->slots));
+	tbl->borrow_keys = 0;
+	tbl->alloc = *alloc;
+	tbl->more = NULL;
+	tbl->filter = NULL;
+	tbl->n_filter_blocks = 0;
+	tbl->filter_ratio = 0;
+	tbl->filter_k = 0;
+	tbl->slots =
+		alloc->alloc(alloc->ctx, TABLE_INIT_SLOTS * sizeof(*tbl->slots));
 	if (!tbl->slots)
 		goto cleanup_fail;
 	return 0;
@@ -24,56 +252,105 @@ cleanup_fail:
 void
 table_destroy(struct Table *tbl)
 {
-	for (size_t i = 0; i < tbl->n_slots; i++) {
+	const size_t size = tbl->n_slots * sizeof(*tbl->slots);
+
+	for (size_t i = 0; i < tbl->n_slots && !tbl->borrow_keys; i++) {
 		if (!tbl->slots[i].key || tbl->slots[i].key == (char *)&tbl->n_tomb)
 			continue;
 		free(tbl->slots[i].key);
 	}
+	tbl->alloc.free(tbl->alloc.ctx, tbl->slots, size);
+	if (tbl->more)
+		tbl->alloc.free(tbl->alloc.ctx, tbl->more, size);
+	_filter_free(tbl);
 }
 
-/* Just double the capacity of the table. */
+/* Just double the capacity of the table. The spare array for exhuming is
+ * the old size now, so drop it too, and the filter grows along. */
 static int
 _table_resize(struct Table *tbl)
 {
-	uint32_t slot;
+	uint32_t hash, slot;
 	const size_t old_cap = tbl->n_slots;
+	const size_t new_cap = old_cap << 1;
 	struct TableEntry *new_slots;
+	uint64_t *new_filter = NULL;
+	size_t new_blocks = 0;
 
-	tbl->n_slots <<= 1;
-	new_slots = calloc(2 * tbl->n_slots, sizeof(*new_slots));
+	new_slots =
+		tbl->alloc.alloc(tbl->alloc.ctx, new_cap * sizeof(*new_slots));
 	if (!new_slots)
 		goto cleanup_fail;
+	if (tbl->filter) {
+		new_blocks = _filter_n_blocks(new_cap, tbl->filter_ratio);
+		new_filter = tbl->alloc.alloc(
+			tbl->alloc.ctx,
+			new_blocks * TABLE_FILTER_BLOCK * sizeof(*new_filter)
+		);
+		if (!new_filter)
+			goto cleanup_fail;
+	}
 
 	for (size_t i = 0; i < old_cap; i++) {
- 	if (!tbl->slots[i].key || tbl->slots[i].key == (char *)&tbl->n_tomb)
-
+		if (!tbl->slots[i].key || tbl->slots[i].key == (char *)&tbl->n_tomb)
 			continue;
 		/* Find new slot */
-		slot = HASH_STR_32((unsigned char *)tbl->slots[i].key) &
-			(tbl->n_slots - 1); /* hash % n */
+		hash = HASH_STR_32((unsigned char *)tbl->slots[i].key);
+		slot = hash & (new_cap - 1); /* hash % n */
 		while (new_slots[slot].key)
-			slot = (slot + 1) & (tbl->n_slots - 1);
+			slot = (slot + 1) & (new_cap - 1);
 		new_slots[slot].key = tbl->slots[i].key;
 		new_slots[slot].val = tbl->slots[i].val;
+		if (new_filter)
+			_filter_update(new_filter, new_blocks, tbl->filter_k, hash, 1);
+	}
+	if (new_filter) {
+		_filter_free(tbl);
+		tbl->filter = new_filter;
+		tbl->n_filter_blocks = new_blocks;
+	}
+	tbl->alloc.free(tbl->alloc.ctx, tbl->slots, old_cap * sizeof(*new_slots));
+	if (tbl->more) {
+		tbl->alloc.free(
+			tbl->alloc.ctx,
+			tbl->more,
+			old_cap * sizeof(*new_slots)
+		);
+		tbl->more = NULL;
 	}
-	free(tbl->slots);
 	tbl->slots = new_slots;
+	tbl->n_slots = new_cap;
 	tbl->n_tomb = 0;
 
 	return 0;
 cleanup_fail:
+	if (new_slots)
+		tbl->alloc.free(
+			tbl->alloc.ctx,
+			new_slots,
+			new_cap * sizeof(*new_slots)
+		);
 	return -1;
 }
 
 /* We don't want to keep reallocating memory even when the required capacity
  * never changes. */
-static void
+static int
 _table_exhume(struct Table *tbl)
 {
 	struct TableEntry *tmp;
 	size_t slot;
 
-	memset(tbl->more, 0, tbl->n_slots * sizeof(*tbl->more));
+	if (!tbl->more) {
+		tbl->more = tbl->alloc.alloc(
+			tbl->alloc.ctx,
+			tbl->n_slots * sizeof(*tbl->more)
+		);
+		if (!tbl->more)
+			return -1;
+	} else {
+		memset(tbl->more, 0, tbl->n_slots * sizeof(*tbl->more));
+	}
 
 	for (size_t i = 0; i < tbl->n_slots; i++) {
 		if (!tbl->slots[i].key || tbl->slots[i].key == (char *)&tbl->n_tomb)
@@ -91,14 +368,17 @@ _table_exhume(struct Table *tbl)
 	tmp = tbl->more;
 	tbl->more = tbl->slots;
 	tbl->slots = tmp;
+	return 0;
 }
 
 static inline struct TableEntry *
-_table_find(struct Table *tbl, const char *key)
+_table_find(struct Table *tbl, const char *key, uint32_t hash)
 {
 	uint32_t slot;
 
-	slot = HASH_STR_32((const unsigned char *)key) & (tbl->n_slots - 1);
+	if (tbl->filter && !_filter_test(tbl, hash))
+		return NULL;
+	slot = hash & (tbl->n_slots - 1);
 	while (tbl->slots[slot].key &&
 	       (tbl->slots[slot].key == (char *)&tbl->n_tomb ||
 	        strcmp(tbl->slots[slot].key, key))) {
@@ -113,11 +393,12 @@ _table_find(struct Table *tbl, const char *key)
 int
 table_insert(struct Table *tbl, const char *key, void *val)
 {
+	const uint32_t hash = HASH_STR_32((const unsigned char *)key);
 	uint32_t slot;
 	struct TableEntry *ent;
 
 	/* If key already exists then update, else insert */
-	ent = _table_find(tbl, key);
+	ent = _table_find(tbl, key, hash);
 	if (ent) {
 		ent->val = val;
 	} else {
@@ -126,23 +407,33 @@ table_insert(struct Table *tbl, const char *key, void *val)
 				goto cleanup_fail;
 		if (100 * (tbl->n_filled + tbl->n_tomb) / tbl->n_slots >
 		    TABLE_RESIZE_RATIO)
-			_table_exhume(tbl);
+			if (_table_exhume(tbl))
+				goto cleanup_fail;
 
-		slot = HASH_STR_32((const unsigned char *)key) &
-			(tbl->n_slots - 1); /* hash % n */
+		slot = hash & (tbl->n_slots - 1); /* hash % n */
 		while (tbl->slots[slot].key &&
 		       tbl->slots[slot].key != (char *)&tbl->n_tomb)
 			slot = (slot + 1) & (tbl->n_slots - 1);
 
 		if (tbl->slots[slot].key == (char *)&tbl->n_tomb)
 			tbl->n_tomb--;
-		tbl->slots[slot].key = malloc(strlen(key) + 1);
 		tbl->slots[slot].val = val;
-		if (!tbl->slots[slot].key) {
-			free(tbl->slots[slot].key);
-			goto cleanup_fail;
+		if (tbl->borrow_keys) {
+			tbl->slots[slot].key = (char *)(uintptr_t)key;
+		} else {
+			tbl->slots[slot].key = malloc(strlen(key) + 1);
+			if (!tbl->slots[slot].key)
+				goto cleanup_fail;
+			strcpy(tbl->slots[slot].key, key);
 		}
-		strcpy(tbl->slots[slot].key, key);
+		if (tbl->filter)
+			_filter_update(
+				tbl->filter,
+				tbl->n_filter_blocks,
+				tbl->filter_k,
+				hash,
+				1
+			);
 
 		tbl->n_filled++;
 	}
@@ -156,12 +447,22 @@ cleanup_fail:
 int
 table_delete(struct Table *tbl, const char *key)
 {
+	const uint32_t hash = HASH_STR_32((const unsigned char *)key);
 	struct TableEntry *addr;
 
-	addr = _table_find(tbl, key);
+	addr = _table_find(tbl, key, hash);
 	if (!addr)
 		return -1;
-	free(addr->key);
+	if (tbl->filter)
+		_filter_update(
+			tbl->filter,
+			tbl->n_filter_blocks,
+			tbl->filter_k,
+			hash,
+			0
+		);
+	if (!tbl->borrow_keys)
+		free(addr->key);
 	addr->key = (char *)&tbl->n_tomb;
 	tbl->n_filled--;
 	tbl->n_tomb++;
@@ -174,9 +475,78 @@ table_find(struct Table *tbl, const char *key)
 {
 	struct TableEntry *addr;
 
-	addr = _table_find(tbl, key);
+	addr = _table_find(tbl, key, HASH_STR_32((const unsigned char *)key));
 	if (!addr)
 		return NULL;
 	else
 		return &addr->val;
 }
+
+int
+table_next(const struct Table *tbl, size_t *pos, const char **key, void **val)
+{
+	for (; *pos < tbl->n_slots; (*pos)++) {
+		const struct TableEntry *entry = tbl->slots + *pos;
+
+		if (!entry->key || entry->key == (const char *)&tbl->n_tomb)
+			continue;
+		*key = entry->key;
+		*val = entry->val;
+		(*pos)++;
+		return 1;
+	}
+	return 0;
+}
+
+int
+table_filter(struct Table *tbl, unsigned ratio)
+{
+	uint64_t *filter;
+	size_t n_blocks;
+
+	if (!ratio) {
+		_filter_free(tbl);
+		tbl->filter_ratio = 0;
+		tbl->filter_k = 0;
+		return 0;
+	}
+
+	n_blocks = _filter_n_blocks(tbl->n_slots, ratio);
+	filter = tbl->alloc.alloc(
+		tbl->alloc.ctx,
+		n_blocks * TABLE_FILTER_BLOCK * sizeof(*filter)
+	);
+	if (!filter)
+		return -1;
+	_filter_free(tbl);
+	tbl->filter = filter;
+	tbl->n_filter_blocks = n_blocks;
+	tbl->filter_ratio = ratio;
+	/* Load sits between 35% and 70%, call it 2 * ratio counters per key,
+	 * and k = ln 2 * counters per key is the usual optimum. Past 8 the
+	 * single block is what limits the false positive rate anyway. */
+	tbl->filter_k = (ratio * 14 + 5) / 10;
+	if (tbl->filter_k > 8)
+		tbl->filter_k = 8;
+
+	for (size_t i = 0; i < tbl->n_slots; i++) {
+		if (!tbl->slots[i].key || tbl->slots[i].key == (char *)&tbl->n_tomb)
+			continue;
+		_filter_update(
+			filter,
+			n_blocks,
+			tbl->filter_k,
+			HASH_STR_32((unsigned char *)tbl->slots[i].key),
+			1
+		);
+	}
+	return 0;
+}
+
+int
+table_filter_pass(struct Table *tbl, const char *key)
+{
+	if (!tbl->filter)
+		return 1;
+	return _filter_test(tbl, HASH_STR_32((const unsigned char *)key));
+}
@@ -0,0 +1,731 @@
+#include "hash.h"
+#include "table.h"
+#include "tree.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define MANIFEST_MAGIC 0x33666e616d657274 /* "tremanf3" */
+#define DIRENT_BUF_SIZE 32768
+
+/* What getdents64(2) hands back */
+struct Dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct ManifestHeader {
+	uint64_t magic;
+	uint64_t n_entries;
+	uint64_t paths_len;
+};
+
+/* Scanning builds a tree of these, flattened into a manifest at the end. */
+struct ScanNode {
+	char *name;
+	uint64_t hash;
+	enum TreeType type;
+	struct ScanNode *parent;
+	struct ScanNode **children;
+	size_t n_children;
+	size_t pending; /* unfinished subdirectories, plus one while listing */
+};
+
+struct Scan {
+	int root_fd; /* directories are opened below it when they're listed */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct ScanNode **queue; /* directories waiting for a worker */
+	size_t n_queue;
+	int done;
+	int err; /* first errno seen */
+};
+
+static uint64_t
+mix64(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111eb;
+	x ^= x >> 31;
+	return x;
+}
+
+static void
+scan_error(struct Scan *scan, int err)
+{
+	pthread_mutex_lock(&scan->lock);
+	if (!scan->err)
+		scan->err = err;
+	pthread_mutex_unlock(&scan->lock);
+}
+
+static struct ScanNode *
+node_new(struct ScanNode *parent, const char *name, enum TreeType type)
+{
+	struct ScanNode *node;
+
+	node = calloc(1, sizeof(*node));
+	if (!node)
+		return NULL;
+	node->name = malloc(strlen(name) + 1);
+	if (!node->name) {
+		free(node);
+		return NULL;
+	}
+	strcpy(node->name, name);
+	node->type = type;
+	node->parent = parent;
+	node->pending = 1;
+	return node;
+}
+
+static void
+node_free(struct ScanNode *node)
+{
+	for (size_t i = 0; i < node->n_children; i++)
+		node_free(node->children[i]);
+	free(node->children);
+	free(node->name);
+	free(node);
+}
+
+static int
+node_cmp(const void *a, const void *b)
+{
+	return strcmp(
+		(*(struct ScanNode *const *)a)->name,
+		(*(struct ScanNode *const *)b)->name
+	);
+}
+
+/* All children are final, so sort them and hash the directory. */
+static void
+node_finish(struct ScanNode *node)
+{
+	uint64_t hash = 0x9e3779b97f4a7c15;
+
+	qsort(node->children, node->n_children, sizeof(*node->children), node_cmp);
+	for (size_t i = 0; i < node->n_children; i++) {
+		struct ScanNode *child = node->children[i];
+
+		hash = mix64(
+			hash ^ fnv1a_64_len(
+				(unsigned char *)child->name,
+				strlen(child->name),
+				0
+			)
+		);
+		hash = mix64(hash ^ child->hash ^ (uint64_t)child->type);
+	}
+	node->hash = hash;
+}
+
+/* Drop a reference on a directory, finishing it and any ancestors that were
+ * only waiting on it. */
+static void
+node_release(struct Scan *scan, struct ScanNode *node)
+{
+	int last;
+
+	for (;;) {
+		pthread_mutex_lock(&scan->lock);
+		last = --node->pending == 0;
+		pthread_mutex_unlock(&scan->lock);
+		if (!last)
+			return;
+
+		node_finish(node);
+		if (!node->parent)
+			break;
+		node = node->parent;
+	}
+
+	pthread_mutex_lock(&scan->lock);
+	scan->done = 1;
+	pthread_cond_broadcast(&scan->cond);
+	pthread_mutex_unlock(&scan->lock);
+}
+
+static int
+node_add_child(struct ScanNode *node, struct ScanNode *child)
+{
+	struct ScanNode **children;
+
+	/* Grow in powers of two */
+	if (!(node->n_children & (node->n_children - 1))) {
+		children = realloc(
+			node->children,
+			(node->n_children ? 2 * node->n_children : 1) * sizeof(*children)
+		);
+		if (!children)
+			return -1;
+		node->children = children;
+	}
+	node->children[node->n_children++] = child;
+	return 0;
+}
+
+/* Hash one non-directory entry of dirfd into child. */
+static int
+scan_leaf(int dirfd, struct ScanNode *child)
+{
+	int fd, ret;
+	char target[4096];
+	ssize_t len;
+
+	if (child->type == tree_link) {
+		len = readlinkat(dirfd, child->name, target, sizeof(target) - 1);
+		if (len == -1)
+			return -1;
+		target[len] = '\0';
+		child->hash = fnv1a_64_len((unsigned char *)target, (size_t)len, 0);
+		return 0;
+	}
+
+	fd = openat(dirfd, child->name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	ret = hash_fd(fd, &child->hash);
+	close(fd);
+	return ret;
+}
+
+/* Open a directory by its path below the root. Only directories being listed
+ * are open, so a wide tree doesn't run out of fds. */
+static int
+node_open(const struct Scan *scan, const struct ScanNode *node)
+{
+	char path[PATH_MAX];
+	size_t len = 0, name_len;
+	const struct ScanNode *n;
+
+	if (!node->parent)
+		return openat(scan->root_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	for (n = node; n->parent; n = n->parent)
+		len += strlen(n->name) + 1;
+	if (len > sizeof(path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	path[--len] = '\0';
+	for (n = node; n->parent; n = n->parent) {
+		name_len = strlen(n->name);
+		len -= name_len;
+		memcpy(path + len, n->name, name_len);
+		if (len)
+			path[--len] = '/';
+	}
+	return openat(
+		scan->root_fd,
+		path,
+		O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC
+	);
+}
+
+static void
+scan_dir(struct Scan *scan, struct ScanNode *node)
+{
+	char *buf;
+	long n;
+	int fd;
+	struct ScanNode **subdirs = NULL;
+	size_t n_subdirs = 0, first_inline;
+
+	fd = node_open(scan, node);
+	if (fd == -1) {
+		scan_error(scan, errno);
+		goto release;
+	}
+	buf = malloc(DIRENT_BUF_SIZE);
+	if (!buf) {
+		scan_error(scan, errno);
+		close(fd);
+		goto release;
+	}
+
+	while ((n = syscall(SYS_getdents64, fd, buf, DIRENT_BUF_SIZE)) > 0) {
+		for (long off = 0; off < n;) {
+			struct Dirent64 *ent = (struct Dirent64 *)(void *)(buf + off);
+			struct ScanNode *child;
+			enum TreeType type;
+			unsigned char d_type = ent->d_type;
+			struct stat sb;
+
+			off += ent->d_reclen;
+			if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+				continue;
+
+			if (d_type == DT_UNKNOWN) {
+				if (fstatat(fd, ent->d_name, &sb, AT_SYMLINK_NOFOLLOW)) {
+					scan_error(scan, errno);
+					continue;
+				}
+				if (S_ISDIR(sb.st_mode))
+					d_type = DT_DIR;
+				else if (S_ISREG(sb.st_mode))
+					d_type = DT_REG;
+				else if (S_ISLNK(sb.st_mode))
+					d_type = DT_LNK;
+			}
+			if (d_type == DT_DIR)
+				type = tree_dir;
+			else if (d_type == DT_REG)
+				type = tree_file;
+			else if (d_type == DT_LNK)
+				type = tree_link;
+			else
+				continue; /* devices, fifos and sockets have no content */
+
+			child = node_new(node, ent->d_name, type);
+			if (!child || node_add_child(node, child)) {
+				scan_error(scan, ENOMEM);
+				if (child)
+					node_free(child);
+				continue;
+			}
+
+			if (type != tree_dir) {
+				if (scan_leaf(fd, child))
+					scan_error(scan, errno);
+				continue;
+			}
+
+			if (!(n_subdirs & (n_subdirs - 1))) {
+				struct ScanNode **tmp = realloc(
+					subdirs,
+					(n_subdirs ? 2 * n_subdirs : 1) * sizeof(*subdirs)
+				);
+				if (!tmp) {
+					scan_error(scan, ENOMEM);
+					node_finish(child);
+					continue;
+				}
+				subdirs = tmp;
+			}
+			subdirs[n_subdirs++] = child;
+		}
+	}
+	if (n == -1)
+		scan_error(scan, errno);
+	free(buf);
+	close(fd);
+
+	/* Hand out what other workers can take, descend into the rest here so
+	 * the queue stays bounded */
+	pthread_mutex_lock(&scan->lock);
+	node->pending += n_subdirs;
+	for (first_inline = 0; first_inline < n_subdirs &&
+	     scan->n_queue < TREE_QUEUE_MAX;
+	     first_inline++)
+		scan->queue[scan->n_queue++] = subdirs[first_inline];
+	if (first_inline)
+		pthread_cond_broadcast(&scan->cond);
+	pthread_mutex_unlock(&scan->lock);
+
+	for (size_t i = first_inline; i < n_subdirs; i++)
+		scan_dir(scan, subdirs[i]);
+	free(subdirs);
+
+release:
+	node_release(scan, node);
+}
+
+static void *
+scan_worker(void *arg)
+{
+	struct Scan *scan = arg;
+	struct ScanNode *node;
+
+	pthread_mutex_lock(&scan->lock);
+	for (;;) {
+		while (!scan->n_queue && !scan->done)
+			pthread_cond_wait(&scan->cond, &scan->lock);
+		if (!scan->n_queue)
+			break;
+		node = scan->queue[--scan->n_queue];
+		pthread_mutex_unlock(&scan->lock);
+		scan_dir(scan, node);
+		pthread_mutex_lock(&scan->lock);
+	}
+	pthread_mutex_unlock(&scan->lock);
+
+	return NULL;
+}
+
+/* Flatten the finished scan tree in preorder. */
+static void
+flatten(
+	struct ScanNode *node,
+	struct TreeEntry *entries,
+	size_t *n_entries,
+	char *paths,
+	size_t *paths_len,
+	size_t parent_path
+)
+{
+	struct TreeEntry *ent = entries + (*n_entries)++;
+	size_t path = *paths_len;
+
+	ent->hash = node->hash;
+	ent->type = node->type;
+	ent->pad = 0;
+	ent->path = (uint32_t)path;
+	if (!node->parent) {
+		paths[(*paths_len)++] = '\0';
+	} else {
+		size_t parent_len = strlen(paths + parent_path);
+
+		if (parent_len) {
+			memcpy(paths + *paths_len, paths + parent_path, parent_len);
+			*paths_len += parent_len;
+			paths[(*paths_len)++] = '/';
+		}
+		strcpy(paths + *paths_len, node->name);
+		*paths_len += strlen(node->name) + 1;
+	}
+
+	for (size_t i = 0; i < node->n_children; i++)
+		flatten(node->children[i], entries, n_entries, paths, paths_len, path);
+	ent->n_desc = (uint32_t)(*n_entries - (size_t)(ent - entries) - 1);
+}
+
+/* Count entries and bytes of paths in a subtree whose own path is path_len
+ * long. */
+static void
+measure(
+	const struct ScanNode *node,
+	size_t path_len,
+	size_t *n_entries,
+	size_t *paths_len
+)
+{
+	(*n_entries)++;
+	*paths_len += path_len + 1;
+	for (size_t i = 0; i < node->n_children; i++)
+		measure(
+			node->children[i],
+			(path_len ? path_len + 1 : 0) + strlen(node->children[i]->name),
+			n_entries,
+			paths_len
+		);
+}
+
+static int
+manifest_index(struct Manifest *man)
+{
+	if (table_init(&man->index))
+		return -1;
+	for (size_t i = 0; i < man->n_entries; i++)
+		if (table_insert(
+				&man->index,
+				man->paths + man->entries[i].path,
+				(void *)(uintptr_t)(i + 1)
+			))
+			return -1;
+	return 0;
+}
+
+int
+tree_scan(const char *root, struct Manifest *man)
+{
+	struct Scan scan;
+	struct ScanNode *root_node;
+	pthread_t threads[TREE_SCAN_THREADS];
+	size_t n_threads = 0;
+	memset(man, 0, sizeof(*man));
+	memset(&scan, 0, sizeof(scan));
+	root_node = node_new(NULL, "", tree_dir);
+	if (!root_node)
+		return -1;
+	scan.root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	scan.queue = malloc(TREE_QUEUE_MAX * sizeof(*scan.queue));
+	if (scan.root_fd == -1 || !scan.queue)
+		goto cleanup_fail;
+	pthread_mutex_init(&scan.lock, NULL);
+	pthread_cond_init(&scan.cond, NULL);
+
+	scan.queue[scan.n_queue++] = root_node;
+	for (; n_threads < TREE_SCAN_THREADS; n_threads++)
+		if (pthread_create(threads + n_threads, NULL, scan_worker, &scan))
+			break;
+	if (!n_threads)
+		scan_worker(&scan);
+	for (size_t i = 0; i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&scan.lock);
+	pthread_cond_destroy(&scan.cond);
+	close(scan.root_fd);
+	scan.root_fd = -1;
+	if (scan.err) {
+		errno = scan.err;
+		goto cleanup_fail;
+	}
+
+	measure(root_node, 0, &man->n_entries, &man->paths_len);
+	man->entries = malloc(man->n_entries * sizeof(*man->entries));
+	man->paths = malloc(man->paths_len);
+	if (!man->entries || !man->paths)
+		goto cleanup_fail;
+	man->n_entries = man->paths_len = 0;
+	flatten(
+		root_node,
+		man->entries,
+		&man->n_entries,
+		man->paths,
+		&man->paths_len,
+		0
+	);
+	if (manifest_index(man))
+		goto cleanup_fail;
+
+	node_free(root_node);
+	free(scan.queue);
+	return 0;
+
+cleanup_fail:
+	if (scan.root_fd != -1)
+		close(scan.root_fd);
+	node_free(root_node);
+	free(scan.queue);
+	free(man->entries);
+	free(man->paths);
+	man->entries = NULL;
+	man->paths = NULL;
+	return -1;
+}
+
+static int
+write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	for (size_t off = 0; off < len; off += (size_t)n) {
+		n = write(fd, (const char *)buf + off, len - off);
+		if (n == -1)
+			return -1;
+	}
+	return 0;
+}
+
+int
+manifest_write(const struct Manifest *man, const char *filename)
+{
+	struct ManifestHeader hdr;
+	int fd;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -1;
+
+	hdr.magic = MANIFEST_MAGIC;
+	hdr.n_entries = man->n_entries;
+	hdr.paths_len = man->paths_len;
+	if (write_all(fd, &hdr, sizeof(hdr)) ||
+	    write_all(fd, man->entries, man->n_entries * sizeof(*man->entries)) ||
+	    write_all(fd, man->paths, man->paths_len))
+		goto cleanup_fail;
+
+	return close(fd);
+
+cleanup_fail:
+	close(fd);
+	return -1;
+}
+
+int
+manifest_load(struct Manifest *man, const char *filename)
+{
+	struct ManifestHeader hdr;
+	struct stat sb;
+	int fd;
+
+	memset(man, 0, sizeof(*man));
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &sb) || (size_t)sb.st_size < sizeof(hdr))
+		goto cleanup_fail;
+
+	man->map_len = (size_t)sb.st_size;
+	man->map = mmap(NULL, man->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (man->map == MAP_FAILED) {
+		man->map = NULL;
+		goto cleanup_fail;
+	}
+	close(fd);
+	fd = -1;
+
+	/* Don't trust anything in there */
+	memcpy(&hdr, man->map, sizeof(hdr));
+	if (hdr.magic != MANIFEST_MAGIC || !hdr.n_entries || !hdr.paths_len ||
+	    hdr.n_entries > (man->map_len - sizeof(hdr)) / sizeof(struct TreeEntry) ||
+	    hdr.paths_len != man->map_len - sizeof(hdr) -
+	        hdr.n_entries * sizeof(struct TreeEntry))
+		goto cleanup_fail;
+	man->n_entries = (size_t)hdr.n_entries;
+	man->paths_len = (size_t)hdr.paths_len;
+	man->entries = (struct TreeEntry *)(void *)((char *)man->map + sizeof(hdr));
+	man->paths = (char *)(man->entries + man->n_entries);
+	if (man->paths[man->paths_len - 1])
+		goto cleanup_fail;
+	for (size_t i = 0; i < man->n_entries; i++)
+		if (man->entries[i].path >= man->paths_len ||
+		    man->entries[i].n_desc >= man->n_entries - i)
+			goto cleanup_fail;
+	/* Every subtree must nest inside its parent's, or a diff could walk out
+	 * of one. Each entry is checked once, by its parent. */
+	if (man->entries[0].n_desc != man->n_entries - 1)
+		goto cleanup_fail;
+	for (size_t i = 0; i < man->n_entries; i++) {
+		const size_t end = i + man->entries[i].n_desc;
+
+		for (size_t j = i + 1; j <= end; j += 1 + man->entries[j].n_desc)
+			if (j + man->entries[j].n_desc > end)
+				goto cleanup_fail;
+	}
+
+	if (manifest_index(man))
+		goto cleanup_fail;
+	return 0;
+
+cleanup_fail:
+	if (fd != -1)
+		close(fd);
+	if (man->map)
+		munmap(man->map, man->map_len);
+	man->map = NULL;
+	man->entries = NULL;
+	man->paths = NULL;
+	return -1;
+}
+
+void
+manifest_destroy(struct Manifest *man)
+{
+	table_destroy(&man->index);
+	if (man->map) {
+		munmap(man->map, man->map_len);
+	} else {
+		free(man->entries);
+		free(man->paths);
+	}
+}
+
+const struct TreeEntry *
+manifest_find(struct Manifest *man, const char *path)
+{
+	void **res;
+
+	res = table_find(&man->index, path);
+	if (!res)
+		return NULL;
+	return man->entries + ((uintptr_t)*res - 1);
+}
+
+const char *
+manifest_path(const struct Manifest *man, const struct TreeEntry *ent)
+{
+	return man->paths + ent->path;
+}
+
+struct Diff {
+	const struct Manifest *old, *new;
+	void (*fn)(enum TreeChange change, const char *path, void *ctx);
+	void *ctx;
+};
+
+static void
+diff_subtree(
+	const struct Diff *diff,
+	const struct Manifest *man,
+	size_t i,
+	enum TreeChange change
+)
+{
+	for (size_t end = i + 1 + man->entries[i].n_desc; i < end; i++)
+		diff->fn(change, manifest_path(man, man->entries + i), diff->ctx);
+}
+
+/* Both entries have the same path. */
+static void
+diff_entries(const struct Diff *diff, size_t i, size_t j)
+{
+	const struct TreeEntry *a = diff->old->entries + i;
+	const struct TreeEntry *b = diff->new->entries + j;
+	size_t a_end, b_end;
+	int cmp;
+
+	if (a->type != b->type) {
+		diff_subtree(diff, diff->old, i, tree_removed);
+		diff_subtree(diff, diff->new, j, tree_added);
+		return;
+	}
+	if (a->hash == b->hash)
+		return;
+	diff->fn(tree_modified, manifest_path(diff->new, b), diff->ctx);
+	if (a->type != tree_dir)
+		return;
+
+	/* Siblings are sorted, so merge them */
+	a_end = i + 1 + a->n_desc;
+	b_end = j + 1 + b->n_desc;
+	for (i++, j++; i < a_end || j < b_end;) {
+		if (i == a_end)
+			cmp = 1;
+		else if (j == b_end)
+			cmp = -1;
+		else
+			cmp = strcmp(
+				manifest_path(diff->old, diff->old->entries + i),
+				manifest_path(diff->new, diff->new->entries + j)
+			);
+
+		if (cmp < 0) {
+			diff_subtree(diff, diff->old, i, tree_removed);
+		} else if (cmp > 0) {
+			diff_subtree(diff, diff->new, j, tree_added);
+		} else {
+			diff_entries(diff, i, j);
+		}
+		if (cmp <= 0)
+			i += 1 + diff->old->entries[i].n_desc;
+		if (cmp >= 0)
+			j += 1 + diff->new->entries[j].n_desc;
+	}
+}
+
+int
+manifest_diff(
+	const struct Manifest *old,
+	const struct Manifest *new,
+	void (*fn)(enum TreeChange change, const char *path, void *ctx),
+	void *ctx
+)
+{
+	struct Diff diff;
+
+	if (!old->n_entries || !new->n_entries)
+		return -1;
+	diff.old = old;
+	diff.new = new;
+	diff.fn = fn;
+	diff.ctx = ctx;
+	diff_entries(&diff, 0, 0);
+	return 0;
+}
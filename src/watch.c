@@ -0,0 +1,690 @@
+#include "hash.h"
+#include "table.h"
+#include "watch.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define WATCH_DIR_MASK                                                      \
+	(IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | \
+	 IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW)
+#define WATCH_EVENT_BUF 65536
+
+int
+watch_init(struct Watch *w)
+{
+	memset(w, 0, sizeof(*w));
+	w->listen_fd = -1;
+	w->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->inotify_fd == -1)
+		goto cleanup_fail;
+	if (table_init(&w->files))
+		goto cleanup_fail;
+	return 0;
+
+cleanup_fail:
+	if (w->inotify_fd != -1)
+		close(w->inotify_fd);
+	return -1;
+}
+
+static void
+client_free(struct WatchClient *c)
+{
+	close(c->fd);
+	free(c->out);
+	free(c);
+}
+
+void
+watch_destroy(struct Watch *w)
+{
+	for (size_t i = 0; i < WATCH_MAX_CLIENTS; i++)
+		if (w->clients[i])
+			client_free(w->clients[i]);
+	if (w->listen_fd != -1)
+		close(w->listen_fd);
+	close(w->inotify_fd);
+
+	for (size_t i = 0; i < w->n_files; i++) {
+		free(w->all_files[i]->path);
+		free(w->all_files[i]);
+	}
+	free(w->all_files);
+	for (size_t i = 0; i < w->n_wd_paths; i++)
+		free(w->wd_paths[i]);
+	free(w->wd_paths);
+	for (size_t i = 0; i < w->n_roots; i++)
+		free(w->roots[i]);
+	free(w->roots);
+	free(w->log);
+	table_destroy(&w->files);
+}
+
+static char *
+path_join(const char *dir, const char *name)
+{
+	char *path;
+
+	path = malloc(strlen(dir) + strlen(name) + 2);
+	if (path)
+		sprintf(path, "%s/%s", dir, name);
+	return path;
+}
+
+static struct WatchFile *
+file_get(struct Watch *w, const char *path, int create)
+{
+	void **res;
+	struct WatchFile *file, **all_files;
+
+	res = table_find(&w->files, path);
+	if (res)
+		return *res;
+	if (!create)
+		return NULL;
+
+	/* Grow in powers of two */
+	if (!(w->n_files & (w->n_files - 1))) {
+		all_files = realloc(
+			w->all_files,
+			(w->n_files ? 2 * w->n_files : 1) * sizeof(*all_files)
+		);
+		if (!all_files)
+			return NULL;
+		w->all_files = all_files;
+	}
+
+	file = calloc(1, sizeof(*file));
+	if (!file)
+		return NULL;
+	file->path = malloc(strlen(path) + 1);
+	if (!file->path || table_insert(&w->files, path, file)) {
+		free(file->path);
+		free(file);
+		return NULL;
+	}
+	strcpy(file->path, path);
+	file->exists = 1;
+	w->all_files[w->n_files++] = file;
+	return file;
+}
+
+/* Drop log entries that a later change to the same file supersedes. */
+static void
+log_prune(struct Watch *w)
+{
+	size_t j = 0;
+
+	for (size_t i = 0; i < w->n_log; i++)
+		if (w->log[i].seq == w->log[i].file->seq)
+			w->log[j++] = w->log[i];
+	w->n_log = j;
+}
+
+static int
+file_changed(struct Watch *w, struct WatchFile *file, int exists)
+{
+	struct WatchChange *log;
+
+	if (w->n_log == w->cap_log) {
+		log_prune(w);
+		if (w->n_log >= w->cap_log / 2) {
+			log = realloc(
+				w->log,
+				(w->cap_log ? 2 * w->cap_log : 64) * sizeof(*log)
+			);
+			if (!log)
+				return -1;
+			w->log = log;
+			w->cap_log = w->cap_log ? 2 * w->cap_log : 64;
+		}
+	}
+
+	file->seq = ++w->seq;
+	file->valid = 0;
+	file->exists = exists;
+	w->log[w->n_log].seq = file->seq;
+	w->log[w->n_log].file = file;
+	w->n_log++;
+	return 0;
+}
+
+static int
+wd_set(struct Watch *w, int wd, char *path)
+{
+	char **wd_paths;
+	size_t n;
+
+	if ((size_t)wd >= w->n_wd_paths) {
+		n = 2 * w->n_wd_paths > (size_t)wd ? 2 * w->n_wd_paths : (size_t)wd + 1;
+		wd_paths = realloc(w->wd_paths, n * sizeof(*wd_paths));
+		if (!wd_paths)
+			return -1;
+		memset(
+			wd_paths + w->n_wd_paths,
+			0,
+			(n - w->n_wd_paths) * sizeof(*wd_paths)
+		);
+		w->wd_paths = wd_paths;
+		w->n_wd_paths = n;
+	}
+	free(w->wd_paths[wd]);
+	w->wd_paths[wd] = path;
+	return 0;
+}
+
+/* Watch dir and everything below it. Files found are new, and so count as
+ * changed, unless this is the initial scan. */
+static int
+watch_dir(struct Watch *w, const char *dir, int initial)
+{
+	int wd, fd, ret = 0;
+	char *path;
+	DIR *dp;
+	struct dirent *ent;
+	struct stat sb;
+	struct WatchFile *file;
+
+	path = malloc(strlen(dir) + 1);
+	if (!path)
+		return -1;
+	strcpy(path, dir);
+	wd = inotify_add_watch(w->inotify_fd, path, WATCH_DIR_MASK);
+	if (wd == -1 || wd_set(w, wd, path)) {
+		free(path);
+		return -1;
+	}
+
+	/* Listed after the watch is in place, so nothing slips between */
+	fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	dp = fdopendir(fd);
+	if (!dp) {
+		close(fd);
+		return -1;
+	}
+	while ((ent = readdir(dp))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+		if (fstatat(fd, ent->d_name, &sb, AT_SYMLINK_NOFOLLOW))
+			continue; /* gone already, we'll hear about it */
+
+		path = path_join(dir, ent->d_name);
+		if (!path) {
+			ret = -1;
+			break;
+		}
+		if (S_ISDIR(sb.st_mode)) {
+			if (watch_dir(w, path, initial))
+				ret = -1;
+		} else if (S_ISREG(sb.st_mode)) {
+			file = file_get(w, path, 1);
+			if (!file || (!initial && file_changed(w, file, 1)))
+				ret = -1;
+		}
+		free(path);
+	}
+	closedir(dp);
+
+	return ret;
+}
+
+int
+watch_add_tree(struct Watch *w, const char *root)
+{
+	char **roots;
+
+	roots = realloc(w->roots, (w->n_roots + 1) * sizeof(*roots));
+	if (!roots)
+		return -1;
+	w->roots = roots;
+	w->roots[w->n_roots] = malloc(strlen(root) + 1);
+	if (!w->roots[w->n_roots])
+		return -1;
+	strcpy(w->roots[w->n_roots++], root);
+	return watch_dir(w, root, 1);
+}
+
+/* A directory went away or out of the tree: so did everything in it. */
+static int
+watch_dir_gone(struct Watch *w, const char *dir)
+{
+	size_t len = strlen(dir);
+	int ret = 0;
+
+	for (size_t i = 0; i < w->n_files; i++) {
+		struct WatchFile *file = w->all_files[i];
+
+		if (file->exists && !strncmp(file->path, dir, len) &&
+		    file->path[len] == '/')
+			if (file_changed(w, file, 0))
+				ret = -1;
+	}
+	for (size_t wd = 0; wd < w->n_wd_paths; wd++) {
+		char *path = w->wd_paths[wd];
+
+		if (path && !strncmp(path, dir, len) &&
+		    (path[len] == '/' || !path[len])) {
+			inotify_rm_watch(w->inotify_fd, (int)wd);
+			free(path);
+			w->wd_paths[wd] = NULL;
+		}
+	}
+	return ret;
+}
+
+/* We lost events, so assume everything changed and look again. watch_dir
+ * recurses, so only the roots are rescanned; directories already watched get
+ * their old watch descriptors back. */
+static int
+watch_overflow(struct Watch *w)
+{
+	int ret = 0;
+
+	for (size_t i = 0; i < w->n_files; i++) {
+		struct WatchFile *file = w->all_files[i];
+		struct stat sb;
+
+		if (file_changed(w, file, !lstat(file->path, &sb)))
+			ret = -1;
+	}
+	for (size_t i = 0; i < w->n_roots; i++)
+		if (watch_dir(w, w->roots[i], 0))
+			ret = -1;
+	return ret;
+}
+
+static int
+watch_event(struct Watch *w, const struct inotify_event *ev)
+{
+	char *path;
+	struct WatchFile *file;
+	struct stat sb;
+	int ret = 0;
+
+	if (ev->mask & IN_Q_OVERFLOW)
+		return watch_overflow(w);
+	if (ev->wd < 0 || (size_t)ev->wd >= w->n_wd_paths || !w->wd_paths[ev->wd])
+		return 0;
+	if (ev->mask & IN_IGNORED) {
+		free(w->wd_paths[ev->wd]);
+		w->wd_paths[ev->wd] = NULL;
+		return 0;
+	}
+	if (!ev->len)
+		return 0;
+
+	path = path_join(w->wd_paths[ev->wd], ev->name);
+	if (!path)
+		return -1;
+
+	if (ev->mask & IN_ISDIR) {
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+			ret = watch_dir(w, path, 0);
+		else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+			ret = watch_dir_gone(w, path);
+	} else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+		file = file_get(w, path, 0);
+		if (file && file->exists)
+			ret = file_changed(w, file, 0);
+	} else if (!lstat(path, &sb) && S_ISREG(sb.st_mode)) {
+		file = file_get(w, path, 1);
+		ret = file ? file_changed(w, file, 1) : -1;
+	}
+
+	free(path);
+	return ret;
+}
+
+int
+watch_process(struct Watch *w)
+{
+	char *buf;
+	ssize_t n;
+	int ret = 0;
+
+	buf = malloc(WATCH_EVENT_BUF);
+	if (!buf)
+		return -1;
+	while ((n = read(w->inotify_fd, buf, WATCH_EVENT_BUF)) > 0) {
+		for (ssize_t off = 0; off < n;) {
+			const struct inotify_event *ev =
+				(const struct inotify_event *)(void *)(buf + off);
+
+			if (watch_event(w, ev))
+				ret = -1;
+			off += (ssize_t)(sizeof(*ev) + ev->len);
+		}
+	}
+	if (n == -1 && errno != EAGAIN && errno != EINTR)
+		ret = -1;
+
+	free(buf);
+	return ret;
+}
+
+int
+watch_hash(struct Watch *w, const char *path, uint64_t *hash)
+{
+	struct WatchFile *file;
+
+	file = file_get(w, path, 0);
+	if (!file || !file->exists)
+		return -1;
+	if (!file->valid) {
+		if (hash_file(file->path, &file->hash))
+			return -1;
+		file->valid = 1;
+	}
+	*hash = file->hash;
+	return 0;
+}
+
+/* Index of the first log entry after token */
+static size_t
+log_after(const struct Watch *w, uint64_t token)
+{
+	size_t lo = 0, hi = w->n_log, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (w->log[mid].seq <= token)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+uint64_t
+watch_changed_since(
+	struct Watch *w,
+	uint64_t token,
+	void (*fn)(const char *path, int exists, void *ctx),
+	void *ctx
+)
+{
+	/* Only a file's latest entry counts, so each is reported once */
+	for (size_t i = log_after(w, token); i < w->n_log; i++)
+		if (w->log[i].seq == w->log[i].file->seq)
+			fn(w->log[i].file->path, w->log[i].file->exists, ctx);
+
+	return w->seq;
+}
+
+int
+watch_listen(struct Watch *w, const char *path)
+{
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	w->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (w->listen_fd == -1)
+		return -1;
+	unlink(path);
+	if (bind(w->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(w->listen_fd, WATCH_MAX_CLIENTS)) {
+		close(w->listen_fd);
+		w->listen_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/* Write out as much of the queued replies as the socket takes right now,
+ * return -1 if the client is gone. */
+static int
+client_flush(struct WatchClient *c)
+{
+	size_t off = 0;
+	ssize_t n;
+
+	while (off < c->out_len) {
+		n = send(c->fd, c->out + off, c->out_len - off, MSG_NOSIGNAL);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+			return -1;
+		if (n == -1)
+			break;
+		off += (size_t)n;
+	}
+	c->out_len -= off;
+	memmove(c->out, c->out + off, c->out_len);
+	return 0;
+}
+
+/* Queue a reply line, growing the buffer for one that doesn't fit */
+static void
+reply_printf(struct WatchClient *c, const char *fmt, ...)
+{
+	va_list ap;
+	size_t cap;
+	char *out;
+	int n;
+
+	while (!c->failed) {
+		va_start(ap, fmt);
+		n = vsnprintf(c->out + c->out_len, c->out_cap - c->out_len, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			goto cleanup_fail;
+		if ((size_t)n < c->out_cap - c->out_len) {
+			c->out_len += (size_t)n;
+			return;
+		}
+		cap = c->out_len + (size_t)n + 1;
+		out = realloc(c->out, cap);
+		if (!out)
+			goto cleanup_fail;
+		c->out = out;
+		c->out_cap = cap;
+	}
+	return;
+
+cleanup_fail:
+	c->failed = 1;
+}
+
+static void
+reply_change(const char *path, int exists, void *ctx)
+{
+	reply_printf(ctx, "%c %s\n", exists ? 'M' : 'D', path);
+}
+
+/* Whether there's room to queue another reply line */
+static int
+client_room(const struct WatchClient *c)
+{
+	return c->out_cap - c->out_len >= WATCH_LINE_MAX;
+}
+
+/* Queue as much more of a CHANGED reply as there's room for. The log is
+ * searched by seq each time round, so it may be pruned or grown in between.
+ * Changes after the request are left for the next one. */
+static void
+client_stream(struct Watch *w, struct WatchClient *c)
+{
+	for (size_t i = log_after(w, c->stream_seq);
+	     i < w->n_log && w->log[i].seq <= c->stream_end;
+	     i++) {
+		const struct WatchChange *change = w->log + i;
+
+		if (!client_room(c))
+			return;
+		if (change->seq == change->file->seq)
+			reply_change(change->file->path, change->file->exists, c);
+		c->stream_seq = change->seq;
+	}
+	reply_printf(c, "TOKEN %llu\n", (unsigned long long)c->stream_end);
+	c->streaming = 0;
+}
+
+static void
+client_request(struct Watch *w, struct WatchClient *c, char *line)
+{
+	unsigned long long token;
+	uint64_t hash;
+
+	if (!strcmp(line, "TOKEN")) {
+		reply_printf(c, "TOKEN %llu\n", (unsigned long long)w->seq);
+	} else if (sscanf(line, "CHANGED %llu", &token) == 1) {
+		c->streaming = 1;
+		c->stream_seq = token;
+		c->stream_end = w->seq;
+		client_stream(w, c);
+	} else if (!strncmp(line, "HASH ", 5) && !watch_hash(w, line + 5, &hash)) {
+		reply_printf(c, "%016llx\n", (unsigned long long)hash);
+	} else {
+		reply_printf(c, "ERR\n");
+	}
+}
+
+/* Answer requests and queue replies for as long as the socket takes them,
+ * a CHANGED reply a piece at a time. Returns -1 once the client should be
+ * dropped. */
+static int
+client_pump(struct Watch *w, struct WatchClient *c)
+{
+	char *nl;
+
+	for (;;) {
+		if (!client_room(c) && client_flush(c))
+			return -1;
+		if (!client_room(c))
+			break;
+		if (c->streaming) {
+			client_stream(w, c);
+		} else if ((nl = memchr(c->buf, '\n', c->len))) {
+			*nl = '\0';
+			client_request(w, c, c->buf);
+			c->len -= (size_t)(nl + 1 - c->buf);
+			memmove(c->buf, nl + 1, c->len);
+		} else {
+			break;
+		}
+	}
+	return c->failed || client_flush(c) ? -1 : 0;
+}
+
+/* Returns -1 once the client should be dropped. */
+static int
+client_read(struct WatchClient *c)
+{
+	ssize_t n;
+
+	n = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+	if (n <= 0)
+		return n == -1 && (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+	c->len += (size_t)n;
+	if (c->len == sizeof(c->buf) && !memchr(c->buf, '\n', c->len))
+		return -1; /* line too long */
+	return 0;
+}
+
+/* Returns -1 once the client should be dropped. */
+static int
+client_serve(struct Watch *w, struct WatchClient *c, short revents)
+{
+	if (revents & ~POLLOUT && client_read(c))
+		return -1;
+	return client_pump(w, c);
+}
+
+static struct WatchClient *
+client_new(int fd)
+{
+	struct WatchClient *c;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+	c->out_cap = WATCH_OUT_BUF;
+	c->out = malloc(c->out_cap);
+	if (!c->out || fcntl(fd, F_SETFL, O_NONBLOCK)) {
+		free(c->out);
+		free(c);
+		return NULL;
+	}
+	c->fd = fd;
+	return c;
+}
+
+int
+watch_poll(struct Watch *w, int timeout)
+{
+	struct pollfd pfds[2 + WATCH_MAX_CLIENTS];
+	struct WatchClient *polled[WATCH_MAX_CLIENTS];
+	nfds_t n = 0, n_clients = 0;
+	int r, fd;
+
+	pfds[n].fd = w->inotify_fd;
+	pfds[n++].events = POLLIN;
+	pfds[n].fd = w->listen_fd; /* ignored by poll if -1 */
+	pfds[n++].events = POLLIN;
+	for (size_t i = 0; i < WATCH_MAX_CLIENTS; i++) {
+		if (!w->clients[i])
+			continue;
+		polled[n_clients++] = w->clients[i];
+		/* Only take new requests once the last replies are out */
+		pfds[n].fd = w->clients[i]->fd;
+		pfds[n++].events = w->clients[i]->out_len ? POLLOUT : POLLIN;
+	}
+
+	r = poll(pfds, n, timeout);
+	if (r == -1)
+		return errno == EINTR ? 0 : -1;
+
+	/* Apply changes before answering anyone */
+	if (pfds[0].revents && watch_process(w))
+		return -1;
+
+	for (nfds_t i = 0; i < n_clients; i++) {
+		if (!pfds[2 + i].revents ||
+		    !client_serve(w, polled[i], pfds[2 + i].revents))
+			continue;
+		for (size_t j = 0; j < WATCH_MAX_CLIENTS; j++)
+			if (w->clients[j] == polled[i])
+				w->clients[j] = NULL;
+		client_free(polled[i]);
+	}
+
+	if (pfds[1].revents) {
+		fd = accept(w->listen_fd, NULL, NULL);
+		if (fd == -1)
+			return 0;
+		for (size_t i = 0; i < WATCH_MAX_CLIENTS; i++) {
+			if (w->clients[i])
+				continue;
+			w->clients[i] = client_new(fd);
+			if (!w->clients[i])
+				break;
+			return 0;
+		}
+		close(fd); /* full up */
+	}
+
+	return 0;
+}
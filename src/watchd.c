@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "watch.h"
+
+#define MAX_ERRORS 16
+
+/* Keep hashes of the given trees up to date and answer queries about them on
+ * a Unix socket, see watch.h for the protocol. */
+int
+main(int argc, char **argv)
+{
+	struct Watch w;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <socket> <dir> [<dir> ...]\n", argv[0]);
+		return 1;
+	}
+
+	if (watch_init(&w)) {
+		perror("inotify");
+		return 1;
+	}
+	for (int i = 2; i < argc; i++) {
+		if (watch_add_tree(&w, argv[i])) {
+			perror(argv[i]);
+			return 1;
+		}
+	}
+	if (watch_listen(&w, argv[1])) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	/* Ride out the odd failure, but not one that keeps coming back */
+	for (int errors = 0; errors < MAX_ERRORS;) {
+		if (!watch_poll(&w, -1)) {
+			errors = 0;
+		} else {
+			perror("watch");
+			errors++;
+		}
+	}
+	fprintf(
+		stderr,
+		"%s: giving up after %d errors in a row\n",
+		argv[0],
+		MAX_ERRORS
+	);
+	watch_destroy(&w);
+	return 1;
+}
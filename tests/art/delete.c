@@ -0,0 +1,53 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+/* Deletes leave the rest in place and every node freed by the end */
+void
+test(struct TestEnv *env)
+{
+	bool *deleted;
+
+	deleted = calloc(env->N, sizeof(*deleted));
+	assert_not_null(deleted);
+
+	for (unsigned i = 0; i < env->N / 3; i++) {
+		unsigned long x = random_ulong() % env->N;
+
+		if (deleted[x])
+			assert_int_eq(art_delete(&env->art, env->keys[x]), -1);
+		else
+			assert_int_eq(art_delete(&env->art, env->keys[x]), 0);
+		deleted[x] = 1;
+	}
+	for (unsigned i = 0; i < env->N; i++) {
+		void **res = art_find(&env->art, env->keys[i]);
+
+		if (deleted[i]) {
+			assert_null(res);
+		} else {
+			assert_not_null(res);
+			assert_ulong_eq((unsigned long)(uintptr_t)*res, i + 1UL);
+		}
+	}
+
+	/* Put them back, then take everything out */
+	for (unsigned i = 0; i < env->N; i++)
+		if (deleted[i])
+			assert_int_eq(
+				art_insert(&env->art, env->keys[i], (void *)(uintptr_t)(i + 1)),
+				0
+			);
+	assert_ulong_eq(env->art.n_keys, (unsigned long)env->N);
+	for (unsigned i = 0; i < env->N; i++)
+		assert_not_null(art_find(&env->art, env->keys[i]));
+	for (unsigned i = 0; i < env->N; i++)
+		assert_int_eq(art_delete(&env->art, env->keys[i]), 0);
+	assert_ulong_eq(env->art.n_keys, 0UL);
+	assert_ulong_eq(env->art.n_bytes, 0UL);
+	assert_null(env->art.root);
+
+	free(deleted);
+}
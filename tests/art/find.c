@@ -0,0 +1,36 @@
+#include <string.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+TEST_INPROCESS_SAFE;
+CHECK_ALLOC_BUDGET(0); /* lookups never allocate */
+
+/* Test whether the initial insert was correct */
+void
+test(struct TestEnv *env)
+{
+	char buf[64];
+
+	assert_ulong_eq(env->art.n_keys, (unsigned long)env->N);
+	for (unsigned i = 0; i < env->N; i++) {
+		void **res = art_find(&env->art, env->keys[i]);
+
+		assert_not_null(res);
+		assert_ulong_eq((unsigned long)(uintptr_t)*res, i + 1UL);
+	}
+
+	/* Near misses: same paths with the last byte changed or dropped */
+	for (unsigned i = 0; i < env->N; i++) {
+		const size_t len = strlen(env->keys[i]);
+
+		strcpy(buf, env->keys[i]);
+		buf[len - 1] = '\x7f';
+		assert_null(art_find(&env->art, buf));
+		strcat(buf, "/x");
+		assert_null(art_find(&env->art, buf));
+	}
+	assert_null(art_find(&env->art, ""));
+	assert_null(art_find(&env->art, "/usr/lib/"));
+	assert_null(art_find(&env->art, "/home/build/project/dir00/sub0/"));
+}
@@ -0,0 +1,64 @@
+#include <string.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+TEST_INPROCESS_SAFE;
+
+struct Walk {
+	const char *prefix;
+	const char *last;
+	unsigned n;
+	unsigned stop_at; /* 0 to go through everything */
+};
+
+static int
+visit(const char *key, void *val, void *ctx)
+{
+	struct Walk *w = ctx;
+
+	assert_int_eq(strncmp(key, w->prefix, strlen(w->prefix)), 0);
+	if (w->last)
+		assert_int(strcmp(w->last, key), <, 0);
+	w->last = key;
+	w->n++;
+	return w->n == w->stop_at;
+}
+
+/* Every key under a prefix comes out once, in order */
+void
+test(struct TestEnv *env)
+{
+	const char *prefixes[] = {
+		"",
+		"/",
+		"/usr/lib/",
+		"/usr/lib/dir07/sub3",
+		"/usr/lib/dir07/sub3/",
+		"/home/build/proj",
+		"/home/build/project/dir1",
+		"/home/build/project/dir42/sub5/",
+		"/home/build/project/dir42/sub5/x",
+		"/nowhere",
+		env->keys[0],
+		env->keys[1],
+	};
+
+	for (size_t i = 0; i < sizeof(prefixes) / sizeof(*prefixes); i++) {
+		struct Walk w = {prefixes[i], NULL, 0, 0};
+		const size_t len = strlen(prefixes[i]);
+		unsigned expect = 0;
+
+		for (unsigned j = 0; j < env->N; j++)
+			expect += !strncmp(env->keys[j], prefixes[i], len);
+		assert_int_eq(art_prefix(&env->art, prefixes[i], visit, &w), 0);
+		assert_uint_eq(w.n, expect);
+
+		if (expect > 1) {
+			struct Walk part = {prefixes[i], NULL, 0, 2};
+
+			assert_int_eq(art_prefix(&env->art, prefixes[i], visit, &part), 1);
+			assert_uint_eq(part.n, 2);
+		}
+	}
+}
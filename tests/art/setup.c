@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+/* Paths under a couple of roots, one longer than a node keeps. Directories
+ * get up to a few hundred entries, so every node size shows up, and some keys
+ * are directories of others. */
+static void
+random_path(char *buf)
+{
+	static const char *roots[] = {"/home/build/project/", "/usr/lib/"};
+	char name[9];
+	int len;
+
+	len = sprintf(
+		buf,
+		"%sdir%02u/sub%u",
+		roots[random_uint() % 2],
+		random_uint() % 64,
+		random_uint() % 8
+	);
+	if (random_uint() % 16) {
+		random_string(name, sizeof(name));
+		sprintf(buf + len, "/%s", name);
+	}
+}
+
+void
+setup_env(struct TestEnv **env)
+{
+	char buf[64];
+
+	*env = malloc(sizeof(**env));
+	assert_not_null(*env);
+	(*env)->N = 200000;
+	(*env)->keys = malloc((*env)->N * sizeof(*(*env)->keys));
+	assert_not_null((*env)->keys);
+	assert_int_eq(art_init(&(*env)->art), 0);
+
+	for (unsigned i = 0; i < (*env)->N; i++) {
+		do {
+			random_path(buf);
+		} while (art_find(&(*env)->art, buf));
+
+		(*env)->keys[i] = malloc(strlen(buf) + 1);
+		assert_not_null((*env)->keys[i]);
+		strcpy((*env)->keys[i], buf);
+		assert_int_eq(
+			art_insert(&(*env)->art, buf, (void *)(uintptr_t)(i + 1)),
+			0
+		);
+	}
+}
+
+void
+teardown_env(struct TestEnv *env)
+{
+	art_destroy(&env->art);
+	for (unsigned i = 0; i < env->N; i++)
+		free(env->keys[i]);
+	free(env->keys);
+	free(env);
+}
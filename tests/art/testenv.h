@@ -0,0 +1,7 @@
+#include "art.h"
+
+struct TestEnv {
+	unsigned N;
+	char **keys;
+	struct Art art;
+};
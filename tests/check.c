@@ -1,20 +1,49 @@
+#define _GNU_SOURCE /* dladdr(3) */
+
 #include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <libgen.h>
+#include <malloc.h>
+#include <poll.h>
+#include <pthread.h>
 #include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 
 #include "check.h"
+#include "hash.h"
+#include "table.h"
 
 /* Configuration */
 #define TEST_SUFFIX ".tst"
+#define CAPTURE_RING_SIZE 65536 /* bytes of output kept per test */
+#define CAPTURE_STREAM_MS 2000  /* stream output of tests slower than this */
+#define STATE_FILE ".check-state"
+#define SHARD_DEFAULT_USEC 100000 /* assumed cost of a test never timed */
+#define SNAPSHOT_SUFFIX ".snap"
+#define SNAPSHOT_MAGIC 0x3270616e736b6863 /* "chksnap2" */
+#define ARENA_BASE ((void *)0x200000000000) /* well clear of the usual maps */
+#define ARENA_RESERVE ((size_t)1 << 36)
+#define ALLOC_SITES 1024 /* distinct callers tracked per test */
+#define ALLOC_TOP 5      /* callers reported with -m */
+#define ALLOC_SITE_NAME 96
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0 /* then we just check where the hint landed */
+#endif
 
 struct TestEnv;
 
@@ -23,12 +52,18 @@ struct Suite {
 
 	char *name;
 	char **test_basenames;
+	unsigned char *in_shard; /* per test, NULL if not sharding */
 };
 
 /* Globals */
 
 jmp_buf _assert_trampoline;
 char *testdir_path;
+int fork_server_flag;
+int alloc_profile_flag;
+int force_flag;
+int seed_flag; /* -s given, so the seed is part of what a test ran with */
+int report_fd = -1; /* shard runners report results here */
 
 /* Utility functions */
 
@@ -44,7 +79,19 @@ max_strlen(char **ss)
 static void
 usage(char *exe)
 {
-	printf("Usage: %s [-h] [-a] [-s <seed>] [<suite1> <suite1> ...]\n", exe);
+	printf(
+		"Usage: %s [-h] [-a] [-w] [-f] [-m] [-s <seed>] [-S <i>/<n> | -j <n>]\n"
+		"          [<suite1> <suite1> ...]\n"
+		"  -h, --help           show this help\n"
+		"  -a, --all            run every suite\n"
+		"  -w, --fork-server    run tests from a preloaded worker\n"
+		"  -f, --force          rerun tests even if unchanged since they passed\n"
+		"  -m, --alloc-profile  report each test's allocations\n"
+		"  -s, --seed <seed>    random seed, also rerun tests last run with another\n"
+		"  -S, --shard <i>/<n>  only run the i-th of n balanced slices of tests\n"
+		"  -j, --jobs <n>       run n shards in parallel and merge the results\n",
+		exe
+	);
 }
 
 static void *
@@ -111,61 +158,1397 @@ is_suite_dir(const struct dirent *ent)
 	/* TODO: actual robust checks */
 }
 
-/* Actual logic */
+/* Output capture
+ *
+ * Test output is read from a pipe into a fixed-size ring, so only the tail of
+ * a chatty test is kept. Tests that run for longer than CAPTURE_STREAM_MS have
+ * their output shown as it arrives instead of after they finish. */
+
+struct Capture {
+	char *ring;
+	size_t len;   /* total bytes received, ring holds the last RING_SIZE */
+	size_t shown; /* bytes already printed */
+	int at_bol;   /* printer is at the beginning of a line */
+};
+
+static void
+capture_init(struct Capture *cap)
+{
+	cap->ring = malloc_s(CAPTURE_RING_SIZE);
+	cap->len = 0;
+	cap->shown = 0;
+	cap->at_bol = 1;
+}
+
+static void
+capture_reset(struct Capture *cap)
+{
+	cap->len = 0;
+	cap->shown = 0;
+	cap->at_bol = 1;
+}
+
+static void
+capture_destroy(struct Capture *cap)
+{
+	free(cap->ring);
+}
+
+/* Read whatever is available on fd into the ring, return what read(2) did. */
+static ssize_t
+capture_read(struct Capture *cap, int fd)
+{
+	size_t off;
+	ssize_t n;
+
+	off = cap->len % CAPTURE_RING_SIZE;
+	do {
+		n = read(fd, cap->ring + off, CAPTURE_RING_SIZE - off);
+	} while (n == -1 && errno == EINTR);
+	if (n > 0)
+		cap->len += (size_t)n;
+	return n;
+}
+
+/* Print captured lines not yet shown, each prefixed with " | ". A trailing
+ * partial line is only printed if final is set. Empty lines are skipped. */
+static void
+capture_print(struct Capture *cap, FILE *out, int final)
+{
+	size_t end;
+
+	if (cap->len - cap->shown > CAPTURE_RING_SIZE) {
+		if (!cap->at_bol)
+			fputc('\n', out);
+		fprintf(
+			out,
+			" | " T_DIM "[... %zu bytes dropped]" T_NORM "\n",
+			cap->len - cap->shown - CAPTURE_RING_SIZE
+		);
+		cap->shown = cap->len - CAPTURE_RING_SIZE;
+		cap->at_bol = 1;
+		/* Don't start in the middle of a line */
+		while (cap->shown < cap->len &&
+		       cap->ring[cap->shown++ % CAPTURE_RING_SIZE] != '\n')
+			;
+	}
+
+	end = cap->len;
+	if (!final)
+		while (end > cap->shown &&
+		       cap->ring[(end - 1) % CAPTURE_RING_SIZE] != '\n')
+			end--;
+
+	for (; cap->shown < end; cap->shown++) {
+		char c = cap->ring[cap->shown % CAPTURE_RING_SIZE];
+
+		if (c == '\n') {
+			if (!cap->at_bol)
+				fputc('\n', out);
+			cap->at_bol = 1;
+			continue;
+		}
+		if (cap->at_bol)
+			fputs(" | ", out);
+		cap->at_bol = 0;
+		fputc(c, out);
+	}
+	if (final && !cap->at_bol) {
+		fputc('\n', out);
+		cap->at_bol = 1;
+	}
+}
+
+/* Drain fd until EOF, or until ctl_fd (if not -1) becomes readable, in which
+ * case whatever is already buffered in fd is still read. If the producer is
+ * still going after CAPTURE_STREAM_MS, switch to streaming the output under
+ * the given test name. */
+static void
+capture_drain(struct Capture *cap, int fd, int ctl_fd, const char *name)
+{
+	struct pollfd pfds[2];
+	struct timespec start, now;
+	int streaming, timeout, r;
+	long elapsed;
+
+	pfds[0].fd = fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = ctl_fd;
+	pfds[1].events = POLLIN;
+	streaming = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (;;) {
+		timeout = -1;
+		if (!streaming) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+				(now.tv_nsec - start.tv_nsec) / 1000000;
+			timeout = (int)MAX(CAPTURE_STREAM_MS - elapsed, 0L);
+		}
+
+		r = poll(pfds, ctl_fd == -1 ? 1 : 2, timeout);
+		if (r == -1 && errno == EINTR)
+			continue;
+		assert_int_neq(r, -1);
+
+		if (r == 0) {
+			printf(
+				T_DIM "[still running, streaming output]" T_NORM "\n"
+			);
+			streaming = 1;
+			capture_print(cap, stdout, 0);
+			fflush(stdout);
+			continue;
+		}
+
+		if (pfds[0].revents) {
+			r = (int)capture_read(cap, fd);
+			assert_int_neq(r, -1);
+			if (r == 0)
+				break;
+			if (streaming) {
+				capture_print(cap, stdout, 0);
+				fflush(stdout);
+			}
+		} else if (ctl_fd != -1 && pfds[1].revents) {
+			/* Producer is done, so its output is all in the pipe */
+			pfds[0].revents = 0;
+			while (poll(pfds, 1, 0) > 0 && capture_read(cap, fd) > 0)
+				;
+			break;
+		}
+	}
+
+	if (streaming) {
+		capture_print(cap, stdout, 1);
+		printf(" test " T_ITAL "%s" T_NORM "... ", name);
+	}
+}
+
+/* In-process capture, for setup which has to run in our own address space.
+ * A thread drains the pipe so a noisy setup cannot fill it and block. */
+
+struct InprocCapture {
+	struct Capture *cap;
+	pthread_t drainer;
+	int fd;
+	int stdout_save, stderr_save;
+};
+
+static void *
+capture_drainer(void *arg)
+{
+	struct InprocCapture *ic = arg;
+
+	while (capture_read(ic->cap, ic->fd) > 0)
+		;
+	return NULL;
+}
 
 static void
-redirect_io_begin(int output_file)
+capture_inproc_begin(struct InprocCapture *ic, struct Capture *cap)
+{
+	int pipefd[2];
+
+	capture_reset(cap);
+	ic->cap = cap;
+	fflush(stdout);
+	fflush(stderr);
+	/* Look, realistically dup(2) and fflush won't fail */
+	ic->stdout_save = dup(STDOUT_FILENO);
+	ic->stderr_save = dup(STDERR_FILENO);
+	assert_int_neq(pipe(pipefd), -1);
+	dup2(pipefd[1], STDOUT_FILENO);
+	dup2(pipefd[1], STDERR_FILENO);
+	close(pipefd[1]);
+	ic->fd = pipefd[0];
+	assert_int_eq(pthread_create(&ic->drainer, NULL, capture_drainer, ic), 0);
+}
+
+static void
+capture_inproc_end(struct InprocCapture *ic)
 {
 	fflush(stdout);
 	fflush(stderr);
-	dup2(output_file, STDOUT_FILENO);
-	dup2(output_file, STDERR_FILENO);
+	/* Closes the last write ends, so the drainer sees EOF */
+	dup2(ic->stdout_save, STDOUT_FILENO);
+	dup2(ic->stderr_save, STDERR_FILENO);
+	close(ic->stdout_save);
+	close(ic->stderr_save);
+	pthread_join(ic->drainer, NULL);
+	close(ic->fd);
+}
+
+/* Actual logic */
+
+/* Environment snapshots
+ *
+ * Setups marked SETUP_SNAPSHOT allocate their environment with arena_alloc.
+ * The arena sits at a fixed address, so after setup it can be written out
+ * as is and mapped straight back (pointers and all) on later runs with the
+ * same setup seed and setup object, going by a hash of all of its bytes.
+ * Forked tests inherit the mapping copy-on-write.
+ *
+ * Each run picks a new seed unless given one with -s, and a snapshot keyed on
+ * it would never be used again, so without -s these setups draw from a fixed
+ * seed instead.
+ */
+
+struct SnapshotHeader {
+	uint64_t magic;
+	uint64_t seed;
+	uint64_t setup_hash;
+	uint64_t size; /* bytes of arena following the header page */
+	struct TestEnv *env;
+};
+
+static char *arena;       /* NULL until first used */
+static int arena_fixed;   /* arena is at ARENA_BASE, so can be snapshotted */
+static size_t arena_used;
+
+static size_t
+page_round(size_t n)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	return (n + page - 1) / page * page;
+}
+
+void *
+arena_alloc(size_t size)
+{
+	void *p;
+
+	if (!arena) {
+		p = mmap(
+			ARENA_BASE,
+			ARENA_RESERVE,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE,
+			-1,
+			0
+		);
+		if (p == MAP_FAILED)
+			return NULL;
+		arena = p;
+		arena_fixed = p == ARENA_BASE;
+		arena_used = 0;
+	}
+
+	size = (size + 15) & ~(size_t)15;
+	if (size > ARENA_RESERVE - arena_used)
+		return NULL;
+	p = arena + arena_used;
+	arena_used += size;
+	return p;
+}
+
+static void
+arena_release(void)
+{
+	if (arena)
+		munmap(arena, ARENA_RESERVE);
+	arena = NULL;
+}
+
+/* Map a matching snapshot into the arena, return its env or NULL. */
+static struct TestEnv *
+snapshot_load(const char *path, unsigned int seed, uint64_t setup_hash)
+{
+	struct SnapshotHeader hdr;
+	struct stat st;
+	int fd;
+	void *p;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    hdr.magic != SNAPSHOT_MAGIC || hdr.seed != seed ||
+	    hdr.setup_hash != setup_hash || hdr.size > ARENA_RESERVE)
+		goto cleanup_fail;
+	/* Touching pages past the end of a truncated file would be SIGBUS */
+	if (fstat(fd, &st) ||
+	    (uint64_t)st.st_size < page_round(sizeof(hdr)) + hdr.size)
+		goto cleanup_fail;
+
+	/* Reserve the whole arena so setup-time helpers can still allocate */
+	if (!arena_alloc(0) || !arena_fixed)
+		goto cleanup_fail;
+	if (hdr.size) {
+		p = mmap(
+			arena,
+			page_round((size_t)hdr.size),
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_FIXED,
+			fd,
+			(off_t)page_round(sizeof(hdr))
+		);
+		if (p == MAP_FAILED)
+			goto cleanup_fail;
+	}
+	arena_used = (size_t)hdr.size;
+
+	close(fd);
+	return hdr.env;
+
+cleanup_fail:
+	close(fd);
+	return NULL;
+}
+
+/* Write the arena out, best effort: a missing snapshot only costs time. */
+static void
+snapshot_save(
+	const char *path,
+	unsigned int seed,
+	uint64_t setup_hash,
+	struct TestEnv *env
+)
+{
+	struct SnapshotHeader hdr;
+	char *tmp_path;
+	int fd;
+	size_t off;
+	ssize_t n;
+
+	if (!arena || !arena_fixed)
+		return;
+
+	/* Shards may be racing to write the same snapshot */
+	tmp_path = malloc_s(strlen(path) + sizeof(".4294967295.tmp"));
+	sprintf(tmp_path, "%s.%u.tmp", path, (unsigned)getpid());
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		goto cleanup;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = SNAPSHOT_MAGIC;
+	hdr.seed = seed;
+	hdr.setup_hash = setup_hash;
+	hdr.size = arena_used;
+	hdr.env = env;
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    lseek(fd, (off_t)page_round(sizeof(hdr)), SEEK_SET) == -1)
+		goto cleanup;
+	for (off = 0; off < arena_used; off += (size_t)n) {
+		n = write(fd, arena + off, arena_used - off);
+		if (n <= 0)
+			goto cleanup;
+	}
+	if (!close(fd)) {
+		fd = -1;
+		rename(tmp_path, path);
+	}
+
+cleanup:
+	if (fd != -1) {
+		close(fd);
+		unlink(tmp_path);
+	}
+	free(tmp_path);
+}
+
+/* Size of a buffer large enough for the path of any object in the suite. */
+static size_t
+suite_path_size(const struct Suite *suite)
+{
+	return strlen(testdir_path) + 1 + strlen(suite->name) + 1 +
+		MAX(max_strlen(suite->test_basenames), strlen("setup")) +
+		MAX(sizeof(TEST_SUFFIX), sizeof(SNAPSHOT_SUFFIX));
 }
 
+static void
+suite_file_path(
+	char *buf,
+	const struct Suite *suite,
+	const char *basename,
+	const char *suffix
+)
+{
+	sprintf(buf, "%s/%s/%s%s", testdir_path, suite->name, basename, suffix);
+}
+
+/* Incremental runs
+ *
+ * For every test the runner remembers the seed and a hash of its inputs (test
+ * object and source, setup object, lib.a and the runner itself) from its last
+ * run, whether it passed and how long it took. Tests whose inputs match a
+ * passing record are skipped unless forced. The seed has to match too if one
+ * was given with -s; otherwise each run picks a new one, and nothing would
+ * ever be skipped. */
+
+struct TestRecord {
+	char *name; /* "suite/test" */
+	uint64_t inputs;
+	unsigned int seed;
+	int passed;
+	long usec;
+	int fresh; /* result of this run, newer than what's on disk */
+	struct TestRecord *next;
+};
+
+static struct Table records; /* name -> struct TestRecord * */
+static struct TestRecord *records_list;
+
+static uint64_t
+hash_combine(uint64_t h, uint64_t x)
+{
+	return (h ^ x) * 0x100000001b3;
+}
+
+/* Hash of a file, or 0 if it can't be read. */
+static uint64_t
+hash_path(char *path)
+{
+	uint64_t h;
+
+	if (hash_file(path, &h))
+		return 0;
+	return h;
+}
+
+static struct TestRecord *
+record_find(const char *suite, const char *test)
+{
+	char *name;
+	void **res;
+
+	name = malloc_s(strlen(suite) + strlen(test) + 2);
+	sprintf(name, "%s/%s", suite, test);
+	res = table_find(&records, name);
+	free(name);
+	return res ? *res : NULL;
+}
+
+static struct TestRecord *
+record_get(const char *suite, const char *test)
+{
+	struct TestRecord *rec;
+
+	rec = record_find(suite, test);
+	if (rec)
+		return rec;
+	rec = calloc_s(1, sizeof(*rec));
+	rec->name = malloc_s(strlen(suite) + strlen(test) + 2);
+	sprintf(rec->name, "%s/%s", suite, test);
+	assert_int_neq(table_insert(&records, rec->name, rec), -1);
+	rec->next = records_list;
+	records_list = rec;
+	return rec;
+}
+
+/* Parse a line of the state file into its record, NULL if malformed. A fresh
+ * record is only overwritten by a fresh line, a result from this run too. */
+static struct TestRecord *
+record_parse(const char *line, int fresh)
+{
+	char name[PATH_MAX];
+	unsigned long long inputs;
+	unsigned int seed;
+	int passed;
+	long usec;
+	struct TestRecord *rec;
+	char *slash;
+
+	if (sscanf(line, "%4095s %llx %u %d %ld", name, &inputs, &seed, &passed,
+	           &usec) != 5)
+		return NULL;
+	slash = strchr(name, '/');
+	if (!slash)
+		return NULL;
+	*slash = '\0';
+	rec = record_get(name, slash + 1);
+	if (rec->fresh && !fresh)
+		return rec;
+	rec->inputs = inputs;
+	rec->seed = seed;
+	rec->passed = passed;
+	rec->usec = usec;
+	rec->fresh = fresh;
+	return rec;
+}
+
+static void
+record_write(int fd, const struct TestRecord *rec)
+{
+	dprintf(
+		fd,
+		"%s %llx %u %d %ld\n",
+		rec->name,
+		(unsigned long long)rec->inputs,
+		rec->seed,
+		rec->passed,
+		rec->usec
+	);
+}
+
+/* Path of the state file, or with n_shards > 1 of the results of a shard. */
 static char *
-redirect_io_end(int output_file, int stdout_save, int stderr_save)
+state_path(unsigned int shard, unsigned int n_shards)
+{
+	char *path;
+
+	path = malloc_s(
+		strlen(testdir_path) + sizeof("/" STATE_FILE ".4294967295-4294967295")
+	);
+	if (n_shards > 1)
+		sprintf(path, "%s/" STATE_FILE ".%u-%u", testdir_path, shard, n_shards);
+	else
+		sprintf(path, "%s/" STATE_FILE, testdir_path);
+	return path;
+}
+
+/* Read the records in a state file, return -1 if there is none. */
+static int
+state_read(const char *path, int fresh)
+{
+	FILE *f;
+	char line[PATH_MAX + 128];
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		record_parse(line, fresh);
+	fclose(f);
+	return 0;
+}
+
+/* Replace a state file with the records, or only the fresh ones. */
+static void
+state_write(const char *path, int fresh_only)
+{
+	char *tmp_path;
+	int fd;
+
+	tmp_path = malloc_s(strlen(path) + sizeof(".4294967295.tmp"));
+	sprintf(tmp_path, "%s.%u.tmp", path, (unsigned)getpid());
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd != -1) {
+		for (struct TestRecord *rec = records_list; rec; rec = rec->next)
+			if (rec->fresh || !fresh_only)
+				record_write(fd, rec);
+		if (!close(fd))
+			rename(tmp_path, path);
+		else
+			unlink(tmp_path);
+	}
+	free(tmp_path);
+}
+
+static void
+state_load(void)
+{
+	char *path;
+
+	assert_int_neq(table_init(&records), -1);
+	records_list = NULL;
+
+	path = state_path(1, 1);
+	state_read(path, 0);
+	free(path);
+}
+
+/* Merge this run's results into the state file, under a lock on the test
+ * directory as other runners may be saving too. Shards of a --shard round all
+ * have to balance on the same recorded costs, so each only puts its results
+ * aside, and the one completing the round merges them all in. */
+static void
+state_save(unsigned int shard, unsigned int n_shards)
+{
+	char *path;
+	int dir_fd;
+
+	dir_fd = open(testdir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd == -1)
+		return;
+	if (flock(dir_fd, LOCK_EX))
+		goto cleanup;
+
+	if (n_shards > 1) {
+		path = state_path(shard, n_shards);
+		state_write(path, 1);
+		free(path);
+		for (unsigned int i = 1; i <= n_shards; i++) {
+			int missing;
+
+			path = state_path(i, n_shards);
+			missing = access(path, F_OK);
+			free(path);
+			if (missing)
+				goto cleanup;
+		}
+		for (unsigned int i = 1; i <= n_shards; i++) {
+			path = state_path(i, n_shards);
+			state_read(path, 1);
+			free(path);
+		}
+	}
+
+	path = state_path(1, 1);
+	state_read(path, 0);
+	state_write(path, 0);
+	free(path);
+
+	for (unsigned int i = 1; n_shards > 1 && i <= n_shards; i++) {
+		path = state_path(i, n_shards);
+		unlink(path);
+		free(path);
+	}
+
+cleanup:
+	close(dir_fd);
+}
+
+static void
+state_destroy(void)
+{
+	struct TestRecord *next;
+
+	for (struct TestRecord *rec = records_list; rec; rec = next) {
+		next = rec->next;
+		free(rec->name);
+		free(rec);
+	}
+	table_destroy(&records);
+}
+
+/* Fill in the input hash of every test of the suite. */
+static void
+suite_hash_inputs(const struct Suite *suite, uint64_t *inputs)
+{
+	char self[] = "/proc/self/exe";
+	char *path;
+	uint64_t common;
+
+	path = malloc_s(suite_path_size(suite));
+	suite_file_path(path, suite, "setup", TEST_SUFFIX);
+	common = hash_combine(0, hash_path(path));
+	sprintf(path, "%s/lib.a", testdir_path);
+	common = hash_combine(common, hash_path(path));
+	common = hash_combine(common, hash_path(self));
+
+	for (size_t i = 0; i < suite->n_tests; i++) {
+		inputs[i] = common;
+		suite_file_path(path, suite, suite->test_basenames[i], TEST_SUFFIX);
+		inputs[i] = hash_combine(inputs[i], hash_path(path));
+		suite_file_path(path, suite, suite->test_basenames[i], ".c");
+		inputs[i] = hash_combine(inputs[i], hash_path(path));
+	}
+	free(path);
+}
+
+static long
+usec_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000 +
+		(now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/* Sharding
+ *
+ * --shard i/N runs the i-th of N deterministic, cost-balanced slices of the
+ * selected tests: longest first (by recorded duration) onto whichever shard
+ * is least loaded so far. --jobs N forks N such shards locally, each pinned
+ * to its own slice of a NUMA node's CPUs, and merges what they report.
+ * Results of --shard runs are saved once the whole round has run, see
+ * state_save. */
+
+struct ShardItem {
+	long cost;
+	struct Suite *suite;
+	size_t test;
+};
+
+static int
+shard_item_cmp(const void *a, const void *b)
+{
+	const struct ShardItem *x = a, *y = b;
+	int r;
+
+	if (x->cost != y->cost)
+		return x->cost < y->cost ? 1 : -1;
+	r = strcmp(x->suite->name, y->suite->name);
+	if (r)
+		return r;
+	return strcmp(
+		x->suite->test_basenames[x->test],
+		y->suite->test_basenames[y->test]
+	);
+}
+
+/* Mark the tests belonging to shard (1-based) of n_shards. */
+static void
+shard_select(
+	struct Suite *suites,
+	ssize_t n_suites,
+	unsigned int shard,
+	unsigned int n_shards
+)
+{
+	struct ShardItem *items;
+	size_t n_items;
+	long *loads;
+
+	n_items = 0;
+	for (ssize_t i = 0; i < n_suites; i++)
+		n_items += suites[i].n_tests;
+	items = malloc_s(n_items * sizeof(*items));
+	loads = calloc_s(n_shards, sizeof(*loads));
+
+	n_items = 0;
+	for (ssize_t i = 0; i < n_suites; i++) {
+		suites[i].in_shard = calloc_s(suites[i].n_tests, 1);
+		for (size_t j = 0; j < suites[i].n_tests; j++) {
+			struct TestRecord *rec;
+
+			rec = record_find(suites[i].name, suites[i].test_basenames[j]);
+			items[n_items].cost = rec ? MAX(rec->usec, 1L) : SHARD_DEFAULT_USEC;
+			items[n_items].suite = suites + i;
+			items[n_items].test = j;
+			n_items++;
+		}
+	}
+	qsort(items, n_items, sizeof(*items), shard_item_cmp);
+
+	for (size_t i = 0; i < n_items; i++) {
+		unsigned int min = 0;
+
+		for (unsigned int s = 1; s < n_shards; s++)
+			if (loads[s] < loads[min])
+				min = s;
+		loads[min] += items[i].cost;
+		if (min == shard - 1)
+			items[i].suite->in_shard[items[i].test] = 1;
+	}
+
+	free(loads);
+	free(items);
+}
+
+/* CPU sets, as raw sched_setaffinity(2) masks */
+
+#define CPU_MAX 4096
+#define CPU_WORD_BITS (8 * sizeof(unsigned long))
+
+struct CpuSet {
+	unsigned long bits[CPU_MAX / CPU_WORD_BITS];
+};
+
+static int
+cpuset_has(const struct CpuSet *set, unsigned int cpu)
+{
+	return (int)(set->bits[cpu / CPU_WORD_BITS] >> (cpu % CPU_WORD_BITS) & 1);
+}
+
+static void
+cpuset_add(struct CpuSet *set, unsigned int cpu)
+{
+	set->bits[cpu / CPU_WORD_BITS] |= 1UL << (cpu % CPU_WORD_BITS);
+}
+
+/* Parse a sysfs cpulist ("0-3,8,10-11") into set, return 0 on success. */
+static int
+cpuset_read_list(struct CpuSet *set, const char *path)
+{
+	FILE *f;
+	unsigned int lo, hi;
+	int c;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	memset(set, 0, sizeof(*set));
+	while (fscanf(f, "%u", &lo) == 1) {
+		hi = lo;
+		c = fgetc(f);
+		if (c == '-') {
+			if (fscanf(f, "%u", &hi) != 1)
+				break;
+			c = fgetc(f);
+		}
+		for (unsigned int cpu = lo; cpu <= hi && cpu < CPU_MAX; cpu++)
+			cpuset_add(set, cpu);
+		if (c != ',')
+			break;
+	}
+	fclose(f);
+	return 0;
+}
+
+static void
+cpuset_format(const struct CpuSet *set, char *buf, size_t size)
+{
+	size_t len = 0;
+	int n;
+
+	buf[0] = '\0';
+	for (unsigned int cpu = 0; cpu < CPU_MAX; cpu++) {
+		unsigned int end;
+
+		if (!cpuset_has(set, cpu))
+			continue;
+		for (end = cpu; end + 1 < CPU_MAX && cpuset_has(set, end + 1); end++)
+			;
+		if (end == cpu)
+			n = snprintf(buf + len, size - len, "%s%u", len ? "," : "", cpu);
+		else
+			n = snprintf(
+				buf + len,
+				size - len,
+				"%s%u-%u",
+				len ? "," : "",
+				cpu,
+				end
+			);
+		if (n < 0 || (size_t)n >= size - len)
+			break;
+		len += (size_t)n;
+		cpu = end;
+	}
+}
+
+/* CPUs for shard i (0-based) of n: node i % nodes, shared out between the
+ * shards landing on that node. Only CPUs we may run on are considered. */
+static void
+shard_cpus(struct CpuSet *set, unsigned int i, unsigned int n)
+{
+	struct CpuSet allowed, node;
+	unsigned int n_nodes, on_node, rank, n_cpus, k;
+	char path[64];
+
+	memset(&allowed, 0, sizeof(allowed));
+	if (syscall(SYS_sched_getaffinity, 0, sizeof(allowed), &allowed) == -1)
+		memset(&allowed, 0xff, sizeof(allowed));
+
+	for (n_nodes = 0;; n_nodes++) {
+		sprintf(path, "/sys/devices/system/node/node%u/cpulist", n_nodes);
+		if (access(path, R_OK))
+			break;
+	}
+
+	node = allowed;
+	if (n_nodes) {
+		sprintf(path, "/sys/devices/system/node/node%u/cpulist", i % n_nodes);
+		if (cpuset_read_list(&node, path))
+			node = allowed;
+		for (size_t w = 0; w < CPU_MAX / CPU_WORD_BITS; w++)
+			node.bits[w] &= allowed.bits[w];
+		on_node = n / n_nodes + (i % n_nodes < n % n_nodes);
+		rank = i / n_nodes;
+	} else {
+		on_node = n;
+		rank = i;
+	}
+
+	n_cpus = 0;
+	for (unsigned int cpu = 0; cpu < CPU_MAX; cpu++)
+		n_cpus += (unsigned)cpuset_has(&node, cpu);
+	if (!n_cpus) {
+		*set = allowed;
+		return;
+	}
+
+	/* Contiguous share of the node, or just one CPU if there are too few */
+	memset(set, 0, sizeof(*set));
+	k = 0;
+	for (unsigned int cpu = 0; cpu < CPU_MAX; cpu++) {
+		if (!cpuset_has(&node, cpu))
+			continue;
+		if (n_cpus >= on_node ? k * on_node / n_cpus == rank
+		                      : k == rank % n_cpus)
+			cpuset_add(set, cpu);
+		k++;
+	}
+}
+
+/* Output collected from a shard */
+struct Buffer {
+	char *data;
+	size_t len, cap;
+};
+
+static ssize_t
+buffer_read(struct Buffer *buf, int fd)
+{
+	ssize_t n;
+
+	if (buf->cap - buf->len < 4096) {
+		buf->cap = MAX(2 * buf->cap, (size_t)8192);
+		buf->data = realloc_s(buf->data, buf->cap);
+	}
+	do {
+		n = read(fd, buf->data + buf->len, buf->cap - buf->len - 1);
+	} while (n == -1 && errno == EINTR);
+	if (n > 0)
+		buf->len += (size_t)n;
+	buf->data[buf->len] = '\0';
+	return n;
+}
+
+/* Fork n_jobs shard runners. Returns 1 in each runner, which should carry on
+ * with its shard selected; the coordinator merges their results, saves state
+ * and returns 0. */
+static int
+coordinate(unsigned int n_jobs, struct Suite *suites, ssize_t n_suites)
+{
+	pid_t *pids;
+	struct pollfd *pfds;    /* output then report fd, per shard */
+	struct Buffer *bufs;    /* likewise */
+	struct CpuSet *cpus;
+	size_t n_open;
+	unsigned long n_passed, n_failed;
+	long usec;
+	struct timespec start;
+
+	pids = malloc_s(n_jobs * sizeof(*pids));
+	pfds = malloc_s(2 * n_jobs * sizeof(*pfds));
+	bufs = calloc_s(2 * n_jobs, sizeof(*bufs));
+	cpus = malloc_s(n_jobs * sizeof(*cpus));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fflush(stdout);
+	fflush(stderr);
+	for (unsigned int i = 0; i < n_jobs; i++) {
+		int out[2], report[2];
+
+		shard_cpus(cpus + i, i, n_jobs);
+		assert_int_neq(pipe(out), -1);
+		assert_int_neq(pipe(report), -1);
+		pids[i] = fork();
+		assert_int_neq(pids[i], -1);
+		if (!pids[i]) {
+			for (unsigned int j = 0; j < 2 * i; j++)
+				close(pfds[j].fd);
+			close(out[0]);
+			close(report[0]);
+			dup2(out[1], STDOUT_FILENO);
+			dup2(out[1], STDERR_FILENO);
+			close(out[1]);
+			report_fd = report[1];
+			syscall(SYS_sched_setaffinity, 0, sizeof(cpus[i]), cpus + i);
+			shard_select(suites, n_suites, i + 1, n_jobs);
+			free(pids);
+			free(pfds);
+			free(bufs);
+			free(cpus);
+			return 1;
+		}
+		close(out[1]);
+		close(report[1]);
+		pfds[2 * i].fd = out[0];
+		pfds[2 * i + 1].fd = report[0];
+		pfds[2 * i].events = pfds[2 * i + 1].events = POLLIN;
+	}
+
+	/* Drain everything until every shard has closed everything */
+	for (n_open = 2 * n_jobs; n_open;) {
+		if (poll(pfds, 2 * n_jobs, -1) == -1) {
+			assert_int_eq(errno, EINTR);
+			continue;
+		}
+		for (size_t j = 0; j < 2 * n_jobs; j++) {
+			if (pfds[j].fd == -1 || !pfds[j].revents)
+				continue;
+			if (buffer_read(bufs + j, pfds[j].fd) <= 0) {
+				close(pfds[j].fd);
+				pfds[j].fd = -1;
+				n_open--;
+			}
+		}
+	}
+
+	n_passed = n_failed = 0;
+	for (unsigned int i = 0; i < n_jobs; i++) {
+		char cpu_list[256];
+		char *line, *save;
+		int child_stat;
+
+		assert_int_neq(waitpid(pids[i], &child_stat, 0), -1);
+		cpuset_format(cpus + i, cpu_list, sizeof(cpu_list));
+		printf(
+			T_BOLD "Shard %u/%u" T_NORM T_DIM " (cpus %s)%s" T_NORM "\n",
+			i + 1,
+			n_jobs,
+			cpu_list,
+			WIFEXITED(child_stat) && !WEXITSTATUS(child_stat)
+				? ""
+				: ", exited abnormally"
+		);
+		if (bufs[2 * i].len)
+			fwrite(bufs[2 * i].data, 1, bufs[2 * i].len, stdout);
+
+		/* Same format as the state file */
+		if (!bufs[2 * i + 1].len)
+			continue;
+		for (line = strtok_r(bufs[2 * i + 1].data, "\n", &save); line;
+		     line = strtok_r(NULL, "\n", &save)) {
+			struct TestRecord *rec = record_parse(line, 1);
+
+			if (rec && rec->passed)
+				n_passed++;
+			else if (rec)
+				n_failed++;
+		}
+	}
+
+	usec = usec_since(&start);
+	printf(
+		T_BOLD "%lu tests run on %u shards in %ld.%03lds: " T_NORM T_GREEN
+		"%lu passed" T_NORM ", " "%s%lu failed" T_NORM "\n",
+		n_passed + n_failed,
+		n_jobs,
+		usec / 1000000,
+		usec / 1000 % 1000,
+		n_passed,
+		n_failed ? T_RED : "",
+		n_failed
+	);
+
+	for (size_t j = 0; j < 2 * n_jobs; j++)
+		free(bufs[j].data);
+	free(pids);
+	free(pfds);
+	free(bufs);
+	free(cpus);
+	return 0;
+}
+
+/* Allocation profiling
+ *
+ * The runner and every test object are linked with --wrap for malloc, calloc,
+ * realloc and free, so whatever a test allocates, directly or through the
+ * library, comes through the wrappers below. They only count in a process
+ * running a test, and only with -m or for a test with CHECK_ALLOC_BUDGET. The
+ * counts go back to the runner through a shared mapping. Allocations libc
+ * makes for itself (strdup, fopen, ...) aren't seen. */
+
+struct AllocSite {
+	const void *addr; /* return address of the call */
+	unsigned long n;
+	unsigned long bytes;
+};
+
+struct AllocStats {
+	int done; /* the rest is filled in */
+	unsigned long n_allocs;
+	unsigned long n_frees;
+	unsigned long bytes; /* as requested */
+	long live;           /* usable bytes, from the start of the test */
+	long peak;
+	size_t n_top;
+	struct AllocSite top[ALLOC_TOP];
+	char top_names[ALLOC_TOP][ALLOC_SITE_NAME];
+	struct AllocSite sites[ALLOC_SITES];
+};
+
+void *
+__real_malloc(size_t size);
+void *
+__real_calloc(size_t nmemb, size_t size);
+void *
+__real_realloc(void *ptr, size_t size);
+void
+__real_free(void *ptr);
+
+static struct AllocStats *alloc_stats; /* shared with the test processes */
+static int alloc_counting;
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+alloc_count(const void *site, size_t size, void *p, size_t freed)
+{
+	struct AllocStats *st = alloc_stats;
+	size_t i;
+
+	pthread_mutex_lock(&alloc_lock);
+	st->n_allocs++;
+	st->bytes += size;
+	st->live += (long)malloc_usable_size(p) - (long)freed;
+	st->peak = MAX(st->peak, st->live);
+
+	i = (size_t)((uint64_t)(uintptr_t)site * 0x9e3779b97f4a7c15 >> 32);
+	for (size_t j = 0; j < ALLOC_SITES; j++) {
+		struct AllocSite *s = st->sites + (i + j) % ALLOC_SITES;
+
+		if (!s->addr)
+			s->addr = site;
+		if (s->addr == site) {
+			s->n++;
+			s->bytes += size;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&alloc_lock);
+}
+
+static void
+alloc_count_free(void *p)
+{
+	pthread_mutex_lock(&alloc_lock);
+	alloc_stats->n_frees++;
+	alloc_stats->live -= (long)malloc_usable_size(p);
+	pthread_mutex_unlock(&alloc_lock);
+}
+
+void *
+__wrap_malloc(size_t size)
+{
+	void *p = __real_malloc(size);
+
+	if (alloc_counting && p)
+		alloc_count(__builtin_return_address(0), size, p, 0);
+	return p;
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+	void *p = __real_calloc(nmemb, size);
+
+	if (alloc_counting && p)
+		alloc_count(__builtin_return_address(0), nmemb * size, p, 0);
+	return p;
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+	size_t old;
+	void *p;
+
+	if (!alloc_counting)
+		return __real_realloc(ptr, size);
+	old = ptr ? malloc_usable_size(ptr) : 0;
+	p = __real_realloc(ptr, size);
+	if (p)
+		alloc_count(__builtin_return_address(0), size, p, old);
+	else if (ptr && !size)
+		alloc_count_free(ptr); /* not really, but it's gone */
+	return p;
+}
+
+void
+__wrap_free(void *ptr)
+{
+	if (alloc_counting && ptr)
+		alloc_count_free(ptr);
+	__real_free(ptr);
+}
+
+/* Map the shared counts, once per runner process so shards don't share */
+static void
+alloc_init(void)
 {
-	char *output;
-	size_t output_len;
+	void *p;
 
-	dup2(stdout_save, STDOUT_FILENO);
-	dup2(stderr_save, STDERR_FILENO);
-	output_len = (size_t)lseek(output_file, 0, SEEK_END);
-	output = malloc_s((size_t)output_len + 1);
-	output[output_len] = '\0';
-	lseek(output_file, 0, SEEK_SET);
-	read(output_file, output, output_len);
-	ftruncate(output_file, 0);
+	if (alloc_stats)
+		return;
+	p = mmap(
+		NULL,
+		sizeof(*alloc_stats),
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS,
+		-1,
+		0
+	);
+	assert_ptr_neq(p, MAP_FAILED);
+	alloc_stats = p;
+}
 
-	return output;
+/* Start counting in the process about to run a test */
+static void
+alloc_begin(long budget)
+{
+	if (!alloc_profile_flag && budget < 0)
+		return;
+	memset(alloc_stats, 0, sizeof(*alloc_stats));
+	alloc_counting = 1;
 }
 
+/* Stop counting, name the busiest call sites while their objects are still
+ * loaded, and return 1 if the test went over its budget. */
 static int
-run_test_so(const char *path, struct TestEnv *env)
+alloc_end(long budget)
+{
+	struct AllocStats *st = alloc_stats;
+
+	if (!alloc_counting)
+		return 0;
+	alloc_counting = 0;
+
+	for (size_t i = 0; i < ALLOC_SITES; i++) {
+		const struct AllocSite *s = st->sites + i;
+		size_t j;
+
+		if (!s->n)
+			continue;
+		for (j = st->n_top; j > 0 && st->top[j - 1].n < s->n; j--)
+			if (j < ALLOC_TOP)
+				st->top[j] = st->top[j - 1];
+		if (j < ALLOC_TOP) {
+			st->top[j] = *s;
+			st->n_top += st->n_top < ALLOC_TOP;
+		}
+	}
+	for (size_t i = 0; i < st->n_top; i++) {
+		const char *addr = st->top[i].addr, *obj;
+		Dl_info info;
+
+		if (!dladdr(addr, &info) || !info.dli_fname) {
+			snprintf(
+				st->top_names[i],
+				ALLOC_SITE_NAME,
+				"%p",
+				(const void *)addr
+			);
+			continue;
+		}
+		obj = strrchr(info.dli_fname, '/');
+		obj = obj ? obj + 1 : info.dli_fname;
+		if (info.dli_sname)
+			snprintf(
+				st->top_names[i],
+				ALLOC_SITE_NAME,
+				"%s+%#lx (%s)",
+				info.dli_sname,
+				(unsigned long)(addr - (const char *)info.dli_saddr),
+				obj
+			);
+		else
+			snprintf(
+				st->top_names[i],
+				ALLOC_SITE_NAME,
+				"%s+%#lx",
+				obj,
+				(unsigned long)(addr - (const char *)info.dli_fbase)
+			);
+	}
+	st->done = 1;
+
+	if (budget >= 0 && st->n_allocs > (unsigned long)budget) {
+		printf(
+			T_RED "%lu allocations, over the budget of %ld" T_NORM "\n",
+			st->n_allocs,
+			budget
+		);
+		return 1;
+	}
+	return 0;
+}
+
+/* Stop counting after a test crashed in-process, possibly while counting an
+ * allocation and so holding the lock. Nothing is reported for it. */
+static void
+alloc_abort(void)
+{
+	alloc_counting = 0;
+	pthread_mutex_init(&alloc_lock, NULL);
+}
+
+static void
+alloc_report(void)
+{
+	const struct AllocStats *st = alloc_stats;
+
+	if (!st->done)
+		return;
+	printf(
+		" | " T_DIM "%lu allocations (%.1f KiB), %lu frees, peak %.1f KiB live"
+		T_NORM "\n",
+		st->n_allocs,
+		(double)st->bytes / 1024,
+		st->n_frees,
+		(double)st->peak / 1024
+	);
+	for (size_t i = 0; i < st->n_top; i++)
+		printf(
+			" | " T_DIM "%10lu %12.1f KiB  %s" T_NORM "\n",
+			st->top[i].n,
+			(double)st->top[i].bytes / 1024,
+			st->top_names[i]
+		);
+}
+
+/* Run a loaded test, return its exit status. */
+static int
+call_test(void (*test)(struct TestEnv *env), struct TestEnv *env)
+{
+	if (setjmp(_assert_trampoline))
+		return 1;
+	test(env);
+	return 0;
+}
+
+/* call_test, counting allocations if asked to or if there's a budget */
+static int
+call_test_alloc(
+	void (*test)(struct TestEnv *env),
+	struct TestEnv *env,
+	long budget
+)
+{
+	int status;
+
+	alloc_begin(budget);
+	status = call_test(test, env);
+	return alloc_end(budget) || status;
+}
+
+/* The test's CHECK_ALLOC_BUDGET, -1 if none */
+static long
+test_budget(void *obj)
+{
+	const long *budget = dlsym(obj, "check_alloc_budget");
+
+	return budget ? *budget : -1;
+}
+
+static int
+run_test_so(
+	const char *path,
+	const char *name,
+	struct TestEnv *env,
+	struct Capture *cap
+)
 {
 	int child_stat, exit_status;
+	int pipefd[2];
 	pid_t pid;
 
 	void *test_obj;
 	void (*test)(struct TestEnv *env);
 
+	capture_reset(cap);
+	fflush(stdout);
+	fflush(stderr);
+	assert_int_neq(pipe(pipefd), -1);
+
 	pid = fork();
 	assert_int_neq(pid, -1);
 	if (pid) { /* parent */
-		assert_int_neq(wait(&child_stat), -1);
-		exit_status = WEXITSTATUS(child_stat);
+		close(pipefd[1]);
+		capture_drain(cap, pipefd[0], -1, name);
+		close(pipefd[0]);
+		assert_int_neq(waitpid(pid, &child_stat, 0), -1);
+		exit_status = WIFEXITED(child_stat) ? WEXITSTATUS(child_stat) : 1;
 	} else { /* child */
+		close(pipefd[0]);
+		dup2(pipefd[1], STDOUT_FILENO);
+		dup2(pipefd[1], STDERR_FILENO);
+		close(pipefd[1]);
+
 		test_obj = dlopen(path, RTLD_LAZY | RTLD_LOCAL);
 		assert_not_null(test_obj);
 
 		test = (void (*)(struct TestEnv *))dlsym(test_obj, "test");
 		assert_not_null(test);
-		if (!setjmp(_assert_trampoline)) {
-			test(env);
-			exit_status = 0;
-		} else {
-			exit_status = 1;
-		}
+		exit_status = call_test_alloc(test, env, test_budget(test_obj));
+		fflush(stdout);
+		fflush(stderr);
 
 		dlclose(test_obj);
 		_exit(exit_status);
@@ -174,104 +1557,357 @@ run_test_so(const char *path, struct TestEnv *env)
 	return exit_status;
 }
 
-/* clang-format off */
-static int
-str_split_next(char **s, char c)
+/* Fork-server
+ *
+ * Rather than forking the runner and dlopen(3)ing the test object for every
+ * test, a worker is forked once after setup with all the suite's tests loaded
+ * and relocated up front. Each test then runs in a fork of that worker, or
+ * right inside it if the test is marked TEST_INPROCESS_SAFE. A crash of an
+ * in-process test is caught with sigsetjmp, after which the worker retires and
+ * is restarted for the next test. */
+
+#define WORKER_RETIRING 0x80 /* status flag: worker exits after this test */
+
+struct Worker {
+	pid_t pid; /* -1 if not running */
+	int cmd_fd;    /* test indices go in */
+	int status_fd; /* a status byte per test comes out */
+	int out_fd;    /* combined stdout/stderr */
+
+	const struct Suite *suite;
+	struct TestEnv *env;
+};
+
+static sigjmp_buf _signal_trampoline;
+static const int crash_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+static void
+worker_on_signal(int sig)
 {
-	int len = 0;
-	do {
-		if (!**s)
+	siglongjmp(_signal_trampoline, sig);
+}
+
+static void
+worker_signals(void (*handler)(int))
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handler;
+	sigemptyset(&sa.sa_mask);
+	for (size_t i = 0; i < sizeof(crash_signals) / sizeof(*crash_signals); i++)
+		sigaction(crash_signals[i], &sa, NULL);
+}
+
+static void
+worker_main(struct Worker *w, int cmd_fd, int status_fd)
+{
+	const struct Suite *suite = w->suite;
+	void (**tests)(struct TestEnv *env);
+	long *budgets;
+	int *inprocess;
+	char *path;
+
+	uint32_t i;
+	unsigned char status;
+	int child_stat, sig;
+	pid_t pid;
+
+	if (setjmp(_assert_trampoline))
+		_exit(1);
+
+	/* Load and bind everything now so no test pays for it */
+	tests = malloc_s(suite->n_tests * sizeof(*tests));
+	budgets = malloc_s(suite->n_tests * sizeof(*budgets));
+	inprocess = malloc_s(suite->n_tests * sizeof(*inprocess));
+	path = malloc_s(suite_path_size(suite));
+	for (size_t j = 0; j < suite->n_tests; j++) {
+		void *obj;
+		const int *safe;
+
+		suite_file_path(path, suite, suite->test_basenames[j], TEST_SUFFIX);
+		obj = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+		assert_not_null(obj);
+		tests[j] = (void (*)(struct TestEnv *))dlsym(obj, "test");
+		assert_not_null(tests[j]);
+		safe = dlsym(obj, "test_inprocess_safe");
+		inprocess[j] = safe && *safe;
+		budgets[j] = test_budget(obj);
+	}
+	free(path);
+
+	worker_signals(worker_on_signal);
+	while (read(cmd_fd, &i, sizeof(i)) == sizeof(i) && i < suite->n_tests) {
+		if (inprocess[i]) {
+			if (!(sig = sigsetjmp(_signal_trampoline, 1))) {
+				status = (unsigned char)
+					call_test_alloc(tests[i], w->env, budgets[i]);
+			} else {
+				alloc_abort();
+				printf(
+					T_RED "test crashed with signal %d (%s)" T_NORM "\n",
+					sig,
+					strsignal(sig)
+				);
+				status = 1 | WORKER_RETIRING;
+			}
+		} else {
+			pid = fork();
+			if (!pid) {
+				worker_signals(SIG_DFL);
+				status = (unsigned char)
+					call_test_alloc(tests[i], w->env, budgets[i]);
+				fflush(stdout);
+				fflush(stderr);
+				_exit(status);
+			}
+			if (pid == -1 || waitpid(pid, &child_stat, 0) == -1)
+				status = 1;
+			else
+				status = !WIFEXITED(child_stat) || WEXITSTATUS(child_stat);
+		}
+
+		fflush(stdout);
+		fflush(stderr);
+		if (write(status_fd, &status, 1) != 1 || status & WORKER_RETIRING)
 			break;
-		len++;
-	} while (*++*s != c);
-	*s +=!!** s;
-	return len;
+	}
+	_exit(0);
 }
-/* clang-format on */
 
 static void
-run_suite(const struct Suite *suite)
+worker_init(struct Worker *w, const struct Suite *suite, struct TestEnv *env)
+{
+	w->pid = -1;
+	w->suite = suite;
+	w->env = env;
+}
+
+static void
+worker_start(struct Worker *w)
+{
+	int cmd[2], status[2], out[2];
+
+	assert_int_neq(pipe(cmd), -1);
+	assert_int_neq(pipe(status), -1);
+	assert_int_neq(pipe(out), -1);
+	/* A dead worker should show up as EPIPE, not kill us */
+	signal(SIGPIPE, SIG_IGN);
+
+	fflush(stdout);
+	fflush(stderr);
+	w->pid = fork();
+	assert_int_neq(w->pid, -1);
+	if (!w->pid) {
+		close(cmd[1]);
+		close(status[0]);
+		close(out[0]);
+		dup2(out[1], STDOUT_FILENO);
+		dup2(out[1], STDERR_FILENO);
+		close(out[1]);
+		worker_main(w, cmd[0], status[1]);
+	}
+
+	close(cmd[0]);
+	close(status[1]);
+	close(out[1]);
+	w->cmd_fd = cmd[1];
+	w->status_fd = status[0];
+	w->out_fd = out[0];
+}
+
+static void
+worker_stop(struct Worker *w)
+{
+	if (w->pid == -1)
+		return;
+	close(w->cmd_fd);
+	close(w->status_fd);
+	close(w->out_fd);
+	waitpid(w->pid, NULL, 0);
+	w->pid = -1;
+}
+
+static int
+worker_run(struct Worker *w, uint32_t i, struct Capture *cap)
+{
+	unsigned char status;
+
+	if (w->pid == -1)
+		worker_start(w);
+	capture_reset(cap);
+	if (write(w->cmd_fd, &i, sizeof(i)) != sizeof(i)) {
+		/* Died between tests, try a fresh one */
+		worker_stop(w);
+		worker_start(w);
+		assert_long_eq((long)write(w->cmd_fd, &i, sizeof(i)), (long)sizeof(i));
+	}
+
+	capture_drain(cap, w->out_fd, w->status_fd, w->suite->test_basenames[i]);
+	if (read(w->status_fd, &status, 1) != 1) {
+		worker_stop(w);
+		return 1;
+	}
+	if (status & WORKER_RETIRING)
+		worker_stop(w);
+	return status & 1;
+}
+
+static void
+run_suite(const struct Suite *suite, unsigned int seed)
 {
 	void *setup_obj;
 	void (*setup_env)(struct TestEnv **env);
+	void (*load_env)(struct TestEnv *env);
 	void (*teardown_env)(struct TestEnv *env);
+	const int *snapshot;
+	uint64_t setup_hash;
+	unsigned int setup_seed;
+	int loaded;
 
-	char *output;
-	int output_file;
-	char output_file_name[] = "/tmp/check-XXXXXX";
-	int stdout_save, stderr_save;
+	uint64_t *inputs;
+	int *skip;
+	size_t n_selected, n_skipped;
+
+	struct Capture cap;
+	struct InprocCapture ic;
+	struct Worker worker;
 
 	char *path;
-	size_t path_size;
 
 	struct TestEnv *env;
 
+	/* Work out what actually needs to run */
+	n_selected = suite->n_tests;
+	if (suite->in_shard) {
+		n_selected = 0;
+		for (size_t i = 0; i < suite->n_tests; i++)
+			n_selected += suite->in_shard[i];
+		if (!n_selected)
+			return;
+	}
+	printf("Running test suite " T_BOLD "%s" T_NORM ":\n", suite->name);
+	alloc_init();
+
+	inputs = malloc_s(suite->n_tests * sizeof(*inputs));
+	skip = malloc_s(suite->n_tests * sizeof(*skip));
+	suite_hash_inputs(suite, inputs);
+	n_skipped = 0;
+	for (size_t i = 0; i < suite->n_tests; i++) {
+		struct TestRecord *rec;
+
+		if (suite->in_shard && !suite->in_shard[i])
+			continue;
+		rec = record_find(suite->name, suite->test_basenames[i]);
+		skip[i] = !force_flag && rec && rec->passed &&
+			(!seed_flag || rec->seed == seed) && rec->inputs == inputs[i];
+		n_skipped += (size_t)skip[i];
+	}
+	if (n_selected && n_skipped == n_selected) {
+		printf(
+			T_DIM " all %zu tests unchanged since they passed, skipping"
+			T_NORM "\n",
+			n_skipped
+		);
+		free(inputs);
+		free(skip);
+		return;
+	}
+
+	printf(" verifying setup... ");
+
 	/* Allocate buffer large enough for all test paths */
-	path_size = max_strlen(suite->test_basenames);
-	path_size = strlen(testdir_path) + 1 + MAX(path_size, strlen("setup")) +
-		sizeof(TEST_SUFFIX);
-	path = malloc_s(path_size);
+	path = malloc_s(suite_path_size(suite));
 
-	sprintf(path, "%s/%s/setup.tst", testdir_path, suite->name);
+	suite_file_path(path, suite, "setup", TEST_SUFFIX);
 	setup_obj = dlopen(path, RTLD_LAZY | RTLD_LOCAL);
 	assert_not_null(setup_obj);
 	setup_env = (void (*)(struct TestEnv **))dlsym(setup_obj, "setup_env");
 	assert_not_null(setup_env);
 	teardown_env = (void (*)(struct TestEnv *))dlsym(setup_obj, "teardown_env");
 	assert_not_null(teardown_env);
+	load_env = (void (*)(struct TestEnv *))dlsym(setup_obj, "load_env");
+	snapshot = dlsym(setup_obj, "setup_snapshot");
+	if (snapshot && *snapshot && hash_file(path, &setup_hash))
+		snapshot = NULL;
 
-	/* Look, realistically dup(2) and fflush won't fail */
-	stdout_save = dup(STDOUT_FILENO);
-	stderr_save = dup(STDERR_FILENO);
-	output_file = mkstemp(output_file_name);
-	assert_int_neq(output_file, -1);
+	capture_init(&cap);
 
-	redirect_io_begin(output_file);
+	capture_inproc_begin(&ic, &cap);
 	if (!setjmp(_assert_trampoline)) {
-		setup_env(&env);
-		output = redirect_io_end(output_file, stdout_save, stderr_save);
-		printf(T_GREEN T_BOLD "OK" T_NORM "\n");
-		printf("%s", output);
-		free(output);
+		loaded = 0;
+		if (snapshot && *snapshot) {
+			setup_seed = seed_flag ? seed : 0;
+			suite_file_path(path, suite, "setup", SNAPSHOT_SUFFIX);
+			env = snapshot_load(path, setup_seed, setup_hash);
+			loaded = !!env;
+			if (loaded && load_env)
+				load_env(env);
+			if (!loaded) {
+				srandom(setup_seed);
+				setup_env(&env);
+				snapshot_save(path, setup_seed, setup_hash, env);
+			}
+		} else {
+			setup_env(&env);
+		}
+		capture_inproc_end(&ic);
+		printf(
+			T_GREEN T_BOLD "OK" T_NORM "%s\n",
+			loaded ? T_DIM " [from snapshot]" T_NORM : ""
+		);
+		capture_print(&cap, stdout, 1);
 	} else {
-		output = redirect_io_end(output_file, stdout_save, stderr_save);
+		capture_inproc_end(&ic);
 		printf(T_RED T_BOLD "FAIL [skipping test suite]" T_NORM "\n");
-		printf("%s", output);
-		free(output);
+		capture_print(&cap, stdout, 1);
 		exit(0);
 	}
 
+	/* Tests see the same random stream whether or not setup really ran */
+	srandom(seed);
+
+	worker_init(&worker, suite, env);
 	for (size_t i = 0; i < suite->n_tests; i++) {
 		int exit_status;
+		struct timespec start;
+		struct TestRecord *rec;
 
-		sprintf(
-			path,
-			"%s/%s/%s.tst",
-			testdir_path,
-			suite->name,
-			suite->test_basenames[i]
-		);
+		if (suite->in_shard && !suite->in_shard[i])
+			continue;
+		suite_file_path(path, suite, suite->test_basenames[i], TEST_SUFFIX);
 		printf(" test " T_ITAL "%s" T_NORM "... ", suite->test_basenames[i]);
+		if (skip[i]) {
+			printf(T_DIM "unchanged, skipping" T_NORM "\n");
+			continue;
+		}
 
-		redirect_io_begin(output_file);
-		exit_status = run_test_so(path, env);
-		output = redirect_io_end(output_file, stdout_save, stderr_save);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		alloc_stats->done = 0;
+		if (fork_server_flag)
+			exit_status = worker_run(&worker, (uint32_t)i, &cap);
+		else
+			exit_status =
+				run_test_so(path, suite->test_basenames[i], env, &cap);
+
+		rec = record_get(suite->name, suite->test_basenames[i]);
+		rec->inputs = inputs[i];
+		rec->seed = seed;
+		rec->passed = exit_status == 0;
+		rec->usec = usec_since(&start);
+		rec->fresh = 1;
+		if (report_fd != -1)
+			record_write(report_fd, rec);
 
 		if (exit_status == 0)
 			printf(T_GREEN T_BOLD "OK" T_NORM "\n");
 		else
 			printf(T_RED T_BOLD "FAIL" T_NORM "\n");
-
-		int len;
-		for (char *line = output, *next = output; *line;
-		    len = str_split_next(&next, '\n')) {
-			if (len)
-				printf(" | %.*s\n", len, line);
-			line = next;
-		}
-
-		free(output);
+		capture_print(&cap, stdout, 1);
+		if (alloc_profile_flag)
+			alloc_report();
 	}
+	worker_stop(&worker);
 
 	printf(" tearing down environment... ");
 	if (!setjmp(_assert_trampoline)) {
@@ -281,11 +1917,12 @@ run_suite(const struct Suite *suite)
 		printf(T_RED T_BOLD "FAIL" T_NORM "\n");
 	}
 
+	arena_release();
 	dlclose(setup_obj);
-	close(stdout_save);
-	close(stderr_save);
-	close(output_file);
+	capture_destroy(&cap);
 	free(path);
+	free(inputs);
+	free(skip);
 }
 
 int
@@ -297,6 +1934,7 @@ main(int argc, char **argv)
 
 	unsigned int seed;
 	int run_all_flag;
+	unsigned int shard, n_shards, n_jobs;
 
 	/* Initial setup */
 
@@ -324,13 +1962,26 @@ main(int argc, char **argv)
 
 	opterr = 0;
 	run_all_flag = 0;
+	shard = n_shards = n_jobs = 1;
 	srand(time(NULL));
 	seed = (unsigned)rand() / 2;
 	{
 		int c;
-		char *bad_char;
-
-		while ((c = getopt(argc, argv, ":has:")) != -1) {
+		char *bad_char, junk;
+		static const struct option long_opts[] = {
+			{"help", no_argument, NULL, 'h'},
+			{"all", no_argument, NULL, 'a'},
+			{"fork-server", no_argument, NULL, 'w'},
+			{"force", no_argument, NULL, 'f'},
+			{"alloc-profile", no_argument, NULL, 'm'},
+			{"seed", required_argument, NULL, 's'},
+			{"shard", required_argument, NULL, 'S'},
+			{"jobs", required_argument, NULL, 'j'},
+			{NULL, 0, NULL, 0},
+		};
+
+		while ((c = getopt_long(argc, argv, ":hawfms:S:j:", long_opts, NULL)
+		       ) != -1) {
 			switch (c) {
 			case 'h':
 				usage(argv[0]);
@@ -338,18 +1989,52 @@ main(int argc, char **argv)
 			case 'a':
 				run_all_flag = 1;
 				break;
+			case 'w':
+				fork_server_flag = 1;
+				break;
+			case 'f':
+				force_flag = 1;
+				break;
+			case 'm':
+				alloc_profile_flag = 1;
+				break;
 			case 's':
 				seed = strtol(optarg, &bad_char, 10);
+				seed_flag = 1;
 				if (*bad_char) {
 					fprintf(stderr, "Invalid seed: %s\n", optarg);
 					assert_quiet(0);
 				}
 				break;
+			case 'S':
+				if (sscanf(optarg, "%u/%u%c", &shard, &n_shards, &junk) != 2 ||
+				    !shard || shard > n_shards) {
+					fprintf(stderr, "Invalid shard: %s\n", optarg);
+					assert_quiet(0);
+				}
+				break;
+			case 'j':
+				n_jobs = (unsigned)strtoul(optarg, &bad_char, 10);
+				if (*bad_char || !n_jobs || n_jobs > CPU_MAX) {
+					fprintf(stderr, "Invalid job count: %s\n", optarg);
+					assert_quiet(0);
+				}
+				break;
 			case '?':
-				fprintf(stderr, "Unknown option: -%c\n", optopt);
+				if (optopt)
+					fprintf(stderr, "Unknown option: -%c\n", optopt);
+				else
+					fprintf(stderr, "Unknown option: %s\n", argv[optind - 1]);
 				exit(1);
 			case ':':
-				fprintf(stderr, "Option -%c requires an argument\n", optopt);
+				if (optopt)
+					fprintf(stderr, "Option -%c requires an argument\n", optopt);
+				else
+					fprintf(
+						stderr,
+						"Option %s requires an argument\n",
+						argv[optind - 1]
+					);
 				exit(1);
 
 			default:
@@ -408,6 +2093,7 @@ main(int argc, char **argv)
 				suites[i].test_basenames[j] = test_ents[j]->d_name;
 			}
 			suites[i].test_basenames[suites[i].n_tests] = NULL;
+			suites[i].in_shard = NULL;
 		}
 		free(suite_path);
 	}
@@ -417,17 +2103,26 @@ main(int argc, char **argv)
 	{
 		printf("Using seed %d\n", seed);
 		srand(seed);
-		for (ssize_t i = 0; i < n_suites; i++) {
-			printf(
-				"Running test suite " T_BOLD "%s" T_NORM ":\n",
-				suites[i].name
-			);
-
-			printf(" verifying setup... ");
-			run_suite(suites + i);
+		state_load();
+		if (n_jobs > 1 && !coordinate(n_jobs, suites, n_suites)) {
+			state_save(1, 1);
+			state_destroy();
+			goto done;
 		}
+		if (n_shards > 1 && report_fd == -1)
+			shard_select(suites, n_suites, shard, n_shards);
+
+		for (ssize_t i = 0; i < n_suites; i++)
+			run_suite(suites + i, seed);
+		if (report_fd == -1)
+			state_save(shard, n_shards);
+		state_destroy();
 	}
 
+done:
+	for (ssize_t i = 0; i < n_suites; i++)
+		free(suites[i].in_shard);
+
 	free(suite_paths);
 	free(testdir_path);
 }
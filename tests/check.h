@@ -91,6 +91,32 @@ extern jmp_buf _assert_trampoline;
 			longjmp(_assert_trampoline, 1); \
 	} while (0);
 
+/* Test attributes */
+
+/* Put this at file scope in a test that leaves the environment as it found it
+ * and does not leak, so the fork-server (-w) may run it without forking. */
+#define TEST_INPROCESS_SAFE const int test_inprocess_safe = 1
+
+/* Put this at file scope to fail the test if it makes more than n calls to
+ * malloc, calloc or realloc, counting those made by library code on its
+ * behalf. Run the suite with -m to see where they come from. */
+#define CHECK_ALLOC_BUDGET(n) const long check_alloc_budget = (n)
+
+/* Environment snapshots */
+
+/* Put this at file scope in a setup whose environment lives entirely in memory
+ * from arena_alloc. The runner then saves it after the first setup_env and
+ * maps it back on later runs with the same setup object, calling
+ * load_env(env) (if defined) instead of setup_env. Setup draws from a fixed
+ * random seed unless one is given with -s. Teardown must not free arena
+ * memory. */
+#define SETUP_SNAPSHOT const int setup_snapshot = 1
+
+/* Bump allocator over the snapshot arena, NULL if exhausted. Memory is only
+ * released once the suite is done. */
+void *
+arena_alloc(size_t size);
+
 /* Random generators */
 
 void
@@ -100,4 +126,10 @@ random_uint(void);
 unsigned long
 random_ulong(void);
 
+/* Scratch files */
+
+/* Remove name, relative to dirfd, and everything under it if a directory. */
+void
+remove_tree(int dirfd, const char *name);
+
 #endif
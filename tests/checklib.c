@@ -1,5 +1,9 @@
+#include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "check.h"
 
@@ -24,3 +28,24 @@ random_ulong(void)
 {
 	return (unsigned long)random() % (unsigned long)LONG_MAX;
 }
+
+void
+remove_tree(int dirfd, const char *name)
+{
+	int fd;
+	DIR *dir;
+	struct dirent *ent;
+
+	fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	if (fd == -1) {
+		unlinkat(dirfd, name, 0);
+		return;
+	}
+	dir = fdopendir(fd);
+	assert_not_null(dir);
+	while ((ent = readdir(dir)))
+		if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, ".."))
+			remove_tree(fd, ent->d_name);
+	closedir(dir);
+	unlinkat(dirfd, name, AT_REMOVEDIR);
+}
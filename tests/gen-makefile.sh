@@ -12,18 +12,30 @@ test_dir="tests"
 # - the actual test target to run all the tests.
 
 gen_makefile_name="$test_dir/Makefile.gen"
+gen_makefile_tmp="$gen_makefile_name.tmp"
+
+# Allocations from the tests and the library go through the runner's wrappers
+# (see "Allocation profiling" in check.c)
+wrap_flags="-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free"
 
 make_unit_tmpl="$(printf "
 TESTFILE!.tst: TESTFILE!.c %s/checklib.o %s/check.h %s/lib.a
-\t\$(CC) \$(CFLAGS) -shared -o \$@ TESTFILE!.c %s/checklib.o %s/lib.a\n" \
-	"$test_dir" "$test_dir" "$test_dir" "$test_dir" "$test_dir")
+\t\$(CC) \$(CFLAGS) %s -shared -o \$@ TESTFILE!.c %s/checklib.o %s/lib.a\n" \
+	"$test_dir" "$test_dir" "$test_dir" "$wrap_flags" "$test_dir" "$test_dir")
 "
 
-rm -f "$gen_makefile_name"
+rm -f "$gen_makefile_tmp"
+
+# Tests, and the fixture tests some suites run a nested runner on (these live
+# in <suite>/fixture/, which the runner doesn't treat as a suite)
+sources=$(
+	find "$(dirname "$0")" -mindepth 2 -maxdepth 2 -name "*.c"
+	find "$(dirname "$0")" -mindepth 3 -maxdepth 3 -path "*/fixture/*.c"
+)
 
-tests=$(find "$(dirname "$0")" -mindepth 2 -maxdepth 2 -name "*.c" -exec sh -c '
-	printf "$(dirname "$1")/$(basename "$1" .c).tst "' \
-	sh {} \;)
+tests=$(for src in $sources; do
+	printf "%s " "$(dirname "$src")/$(basename "$src" .c).tst"
+done)
 
 {
 
@@ -34,15 +46,24 @@ printf \
 	"$tests" "$test_dir" "$test_dir"
 
 printf \
-	"%s/check: %s/check.c %s/checklib.o %s/check.h\n\t\$(CC) \$(LDFLAGS) -rdynamic -o \$@ \$(LDLIBS) %s/check.c\n" \
-	"$test_dir" "$test_dir" "$test_dir" "$test_dir" "$test_dir";
+	"%s/check: %s/check.c %s/checklib.o %s/check.h %s/lib.a\n\t\$(CC) \$(LDFLAGS) -rdynamic %s -o \$@ %s/check.c %s/lib.a \$(LDLIBS)\n" \
+	"$test_dir" "$test_dir" "$test_dir" "$test_dir" "$test_dir" "$wrap_flags" \
+	"$test_dir" "$test_dir";
 
 printf \
 	"%s/lib.a: \$(OBJS)\n\tar rcs \$@ \$(OBJS)\n" \
 	"$test_dir";
 
-find "$(dirname "$0")" -mindepth 2 -maxdepth 2 -name "*.c" -exec sh -c '
-printf "%s" "$1" | sed "s|TESTFILE!|$(dirname "$2")/$(basename "$2" .c)|g"' \
-	sh "$make_unit_tmpl" {} "$gen_makefile_name" \;;
+for src in $sources; do
+	printf "%s" "$make_unit_tmpl" |
+		sed "s|TESTFILE!|$(dirname "$src")/$(basename "$src" .c)|g"
+done
+
+} >>"$gen_makefile_tmp"
 
-} >>"$gen_makefile_name"
+# Only touch the real one if something changed, so make has less to redo
+if cmp -s "$gen_makefile_tmp" "$gen_makefile_name"; then
+	rm -f "$gen_makefile_tmp"
+else
+	mv -f "$gen_makefile_tmp" "$gen_makefile_name"
+fi
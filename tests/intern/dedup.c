@@ -0,0 +1,29 @@
+#include <string.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+/* Repeats of a word get the same ID, and IDs are dense in order of first use */
+void
+test(struct TestEnv *env)
+{
+	struct Intern in;
+	uint32_t id;
+
+	assert_int_eq(intern_init(&in), 0);
+	for (unsigned i = 0; i < env->N; i++) {
+		assert_int_eq(intern(&in, env->words[i], &id), 0);
+		assert_uint_eq(id, i % env->n_distinct);
+	}
+	assert_uint_eq(in.n_strs, env->n_distinct);
+
+	for (unsigned i = 0; i < env->n_distinct; i++) {
+		assert_int_eq(intern_find(&in, env->words[i], &id), 0);
+		assert_uint_eq(id, i);
+		assert_int_eq(strcmp(intern_str(&in, id), env->words[i]), 0);
+		assert_ptr_neq(intern_str(&in, id), env->words[i]);
+	}
+	assert_int_eq(intern_find(&in, "not interned", &id), -1);
+
+	intern_destroy(&in);
+}
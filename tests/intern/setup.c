@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+void
+setup_env(struct TestEnv **env)
+{
+	const size_t width = 16;
+
+	*env = malloc(sizeof(**env));
+	assert_not_null(*env);
+	(*env)->N = 100000;
+	(*env)->n_distinct = (*env)->N / 4;
+	(*env)->words = malloc((*env)->N * sizeof(*(*env)->words));
+	assert_not_null((*env)->words);
+
+	/* Every word shows up four times, the copies are strings of their own */
+	for (unsigned i = 0; i < (*env)->n_distinct; i++) {
+		char buf[width];
+
+		random_string(buf, width);
+		/* Numbered prefix keeps them distinct */
+		sprintf(buf, "%07u", i);
+		buf[7] = '-';
+		for (unsigned j = 0; j < 4; j++) {
+			char *w = malloc(width);
+
+			assert_not_null(w);
+			memcpy(w, buf, width);
+			(*env)->words[j * (*env)->n_distinct + i] = w;
+		}
+	}
+}
+
+void
+teardown_env(struct TestEnv *env)
+{
+	for (unsigned i = 0; i < env->N; i++)
+		free(env->words[i]);
+	free(env->words);
+	free(env);
+}
@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+/* Strings don't move as the pool grows, however long they are */
+void
+test(struct TestEnv *env)
+{
+	struct Intern in;
+	const char **held;
+	char *big;
+	uint32_t id, big_id;
+
+	held = malloc(env->n_distinct * sizeof(*held));
+	assert_not_null(held);
+	big = malloc(3 * INTERN_PAGE_SIZE);
+	assert_not_null(big);
+	memset(big, 'x', 3 * INTERN_PAGE_SIZE - 1);
+	big[3 * INTERN_PAGE_SIZE - 1] = '\0';
+
+	assert_int_eq(intern_init(&in), 0);
+	for (unsigned i = 0; i < env->n_distinct; i++) {
+		assert_int_eq(intern(&in, env->words[i], &id), 0);
+		held[i] = intern_str(&in, id);
+		if (i == env->n_distinct / 2)
+			assert_int_eq(intern(&in, big, &big_id), 0);
+	}
+
+	for (unsigned i = 0; i < env->n_distinct; i++) {
+		assert_int_eq(intern_find(&in, env->words[i], &id), 0);
+		assert_ptr_eq(intern_str(&in, id), held[i]);
+	}
+	assert_int_eq(intern_find(&in, big, &id), 0);
+	assert_uint_eq(id, big_id);
+	assert_int_eq(strcmp(intern_str(&in, id), big), 0);
+
+	intern_destroy(&in);
+	free(big);
+	free(held);
+}
@@ -0,0 +1,7 @@
+#include "intern.h"
+
+struct TestEnv {
+	unsigned N;    /* number of words, with repeats */
+	char **words;
+	unsigned n_distinct;
+};
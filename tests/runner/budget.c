@@ -0,0 +1,23 @@
+#include <string.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+/* A test making more allocations than CHECK_ALLOC_BUDGET allows fails, forked
+ * either way */
+void
+test(struct TestEnv *env)
+{
+	static char out[1 << 16];
+	const char *fail;
+
+	run_fixture(env, "-f", out, sizeof(out));
+	fail = strstr(out, BUDGET_FAIL);
+	assert_not_null(fail);
+	assert_not_null(strstr(fail, "4 allocations, over the budget of 1"));
+
+	run_fixture(env, "-f -w", out, sizeof(out));
+	fail = strstr(out, BUDGET_FAIL);
+	assert_not_null(fail);
+	assert_not_null(strstr(fail, "4 allocations, over the budget of 1"));
+}
@@ -0,0 +1,20 @@
+#include <stdlib.h>
+
+#include "../../check.h"
+#include "testenv.h"
+
+CHECK_ALLOC_BUDGET(1);
+
+/* Stores go through this, so the allocations can't be left out */
+static void *volatile sink;
+
+/* Goes over its budget */
+void
+test(struct TestEnv *env)
+{
+	(void)env;
+	for (int i = 0; i < 4; i++) {
+		sink = malloc(16);
+		free(sink);
+	}
+}
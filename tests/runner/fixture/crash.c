@@ -0,0 +1,14 @@
+#include <signal.h>
+
+#include "../../check.h"
+#include "testenv.h"
+
+TEST_INPROCESS_SAFE;
+
+/* Takes the fork-server's worker down with it */
+void
+test(struct TestEnv *env)
+{
+	(void)env;
+	raise(SIGSEGV);
+}
@@ -0,0 +1,12 @@
+#include "../../check.h"
+#include "testenv.h"
+
+TEST_INPROCESS_SAFE;
+
+/* Runs after crash, and must get to. Reads env, which may be mapped in from
+ * a snapshot. */
+void
+test(struct TestEnv *env)
+{
+	assert_int_eq(env->value, 1);
+}
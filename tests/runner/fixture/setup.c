@@ -0,0 +1,18 @@
+#include "../../check.h"
+#include "testenv.h"
+
+SETUP_SNAPSHOT;
+
+void
+setup_env(struct TestEnv **env)
+{
+	*env = arena_alloc(sizeof(**env));
+	assert_not_null(*env);
+	(*env)->value = 1;
+}
+
+void
+teardown_env(struct TestEnv *env)
+{
+	(void)env;
+}
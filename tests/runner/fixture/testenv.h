@@ -0,0 +1,3 @@
+struct TestEnv {
+	int value; /* set by setup, checked by next */
+};
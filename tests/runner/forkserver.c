@@ -0,0 +1,28 @@
+#include <string.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+/* A test that crashes fails on its own, and the one after it still runs, be it
+ * from a fork or from the fork-server after its worker went down in-process */
+void
+test(struct TestEnv *env)
+{
+	static char out[1 << 16];
+	const char *crash, *next;
+
+	run_fixture(env, "-f", out, sizeof(out));
+	crash = strstr(out, CRASH_FAIL);
+	next = strstr(out, NEXT_OK);
+	assert_not_null(crash);
+	assert_not_null(next);
+	assert_ptr(crash, <, next);
+
+	run_fixture(env, "-f -w", out, sizeof(out));
+	crash = strstr(out, CRASH_FAIL);
+	next = strstr(out, NEXT_OK);
+	assert_not_null(crash);
+	assert_not_null(next);
+	assert_ptr(crash, <, next);
+	assert_not_null(strstr(crash, "test crashed with signal"));
+}
@@ -0,0 +1,64 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+/* A scratch test directory for a nested runner: the runner itself, so it keeps
+ * its state there, and a suite of links to the fixture tests */
+void
+setup_env(struct TestEnv **env)
+{
+	char exe[PATH_MAX], fixture[PATH_MAX], path[PATH_MAX];
+	size_t fixture_len;
+	ssize_t len;
+	DIR *dir;
+	struct dirent *ent;
+
+	*env = calloc(1, sizeof(**env));
+	assert_not_null(*env);
+	strcpy((*env)->root, "/tmp/check-runner-XXXXXX");
+	assert_not_null(mkdtemp((*env)->root));
+
+	len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+	assert_long(len, >, 0L);
+	exe[len] = '\0';
+	sprintf(path, "%s/check", (*env)->root);
+	assert_int_eq(symlink(exe, path), 0);
+	snprintf(fixture, sizeof(fixture), "%s/runner/fixture", dirname(exe));
+	fixture_len = strlen(fixture);
+
+	sprintf(path, "%s/fixture", (*env)->root);
+	assert_int_eq(mkdir(path, 0755), 0);
+	dir = opendir(fixture);
+	assert_not_null(dir);
+	while ((ent = readdir(dir))) {
+		const size_t name_len = strlen(ent->d_name);
+
+		if (name_len < 4 || strcmp(ent->d_name + name_len - 4, ".tst"))
+			continue;
+		snprintf(
+			fixture + fixture_len,
+			sizeof(fixture) - fixture_len,
+			"/%s",
+			ent->d_name
+		);
+		sprintf(path, "%s/fixture/%s", (*env)->root, ent->d_name);
+		assert_int_eq(symlink(fixture, path), 0);
+	}
+	closedir(dir);
+}
+
+void
+teardown_env(struct TestEnv *env)
+{
+	remove_tree(AT_FDCWD, env->root);
+	free(env);
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+static const char *const tests[] = {"budget", "crash", "next"};
+
+/* How many times out says it ran test */
+static int
+count_runs(const char *out, const char *test)
+{
+	char line[64];
+	int n;
+
+	sprintf(line, " test " T_ITAL "%s" T_NORM "... ", test);
+	n = 0;
+	for (out = strstr(out, line); out; out = strstr(out + 1, line))
+		n++;
+	return n;
+}
+
+/* Every fixture test has a record in the state file */
+static void
+assert_recorded(struct TestEnv *env)
+{
+	static char state[1 << 12];
+	char path[64], name[32];
+	size_t len;
+	FILE *f;
+
+	sprintf(path, "%s/.check-state", env->root);
+	f = fopen(path, "r");
+	assert_not_null(f);
+	len = fread(state, 1, sizeof(state) - 1, f);
+	state[len] = '\0';
+	fclose(f);
+	for (size_t i = 0; i < sizeof(tests) / sizeof(*tests); i++) {
+		sprintf(name, "fixture/%s ", tests[i]);
+		assert_not_null(strstr(state, name));
+	}
+}
+
+static void
+reset_state(struct TestEnv *env)
+{
+	char path[64];
+
+	sprintf(path, "%s/.check-state", env->root);
+	unlink(path);
+}
+
+/* Two shards run every test between them exactly once, whether the second
+ * starts after the first saved its results or both run at once, and the
+ * state ends up with all of them. So does a -j run merging its shards. */
+void
+test(struct TestEnv *env)
+{
+	static char out[2][1 << 16];
+	char cmd[128];
+	FILE *p[2];
+
+	reset_state(env);
+	run_fixture(env, "-S 1/2", out[0], sizeof(out[0]));
+	run_fixture(env, "-S 2/2", out[1], sizeof(out[1]));
+	for (size_t i = 0; i < sizeof(tests) / sizeof(*tests); i++)
+		assert_int_eq(
+			count_runs(out[0], tests[i]) + count_runs(out[1], tests[i]),
+			1
+		);
+	assert_recorded(env);
+
+	reset_state(env);
+	for (int i = 0; i < 2; i++) {
+		sprintf(cmd, "%s/check -S %d/2 fixture 2>&1", env->root, i + 1);
+		p[i] = popen(cmd, "r");
+		assert_not_null(p[i]);
+	}
+	for (int i = 0; i < 2; i++) {
+		size_t len = fread(out[i], 1, sizeof(out[i]) - 1, p[i]);
+
+		out[i][len] = '\0';
+		assert_int_neq(pclose(p[i]), -1);
+	}
+	for (size_t i = 0; i < sizeof(tests) / sizeof(*tests); i++)
+		assert_int_eq(
+			count_runs(out[0], tests[i]) + count_runs(out[1], tests[i]),
+			1
+		);
+	assert_recorded(env);
+
+	reset_state(env);
+	run_fixture(env, "-j 2", out[0], sizeof(out[0]));
+	for (size_t i = 0; i < sizeof(tests) / sizeof(*tests); i++)
+		assert_int_eq(count_runs(out[0], tests[i]), 1);
+	assert_recorded(env);
+}
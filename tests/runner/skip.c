@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+/* As make check runs it, with a new random seed every time: a test that passed
+ * is skipped the second time round, one that failed runs again */
+void
+test(struct TestEnv *env)
+{
+	static char out[1 << 16];
+	char path[64];
+
+	sprintf(path, "%s/.check-state", env->root);
+	unlink(path);
+
+	run_fixture(env, "", out, sizeof(out));
+	assert_not_null(strstr(out, CRASH_FAIL));
+	assert_not_null(strstr(out, NEXT_OK));
+
+	/* The seed comes from the time, make sure it's a different one */
+	sleep(1);
+	run_fixture(env, "", out, sizeof(out));
+	assert_not_null(strstr(out, CRASH_FAIL));
+	assert_not_null(strstr(out, NEXT_SKIPPED));
+
+	/* Unless a seed is given, and it's not the one they ran with */
+	run_fixture(env, "-s 1", out, sizeof(out));
+	run_fixture(env, "-s 2", out, sizeof(out));
+	assert_not_null(strstr(out, NEXT_OK));
+	run_fixture(env, "-s 2", out, sizeof(out));
+	assert_not_null(strstr(out, NEXT_SKIPPED));
+}
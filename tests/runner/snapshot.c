@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+#define FROM_SNAPSHOT "[from snapshot]"
+
+/* Without -s every run has a new seed, and the setup snapshot is reused all
+ * the same. One cut short is set up afresh rather than mapped in. */
+void
+test(struct TestEnv *env)
+{
+	static char out[1 << 16];
+	char path[64];
+
+	sprintf(path, "%s/fixture/setup.snap", env->root);
+	unlink(path);
+
+	run_fixture(env, "-f", out, sizeof(out));
+	assert_null(strstr(out, FROM_SNAPSHOT));
+	assert_not_null(strstr(out, NEXT_OK));
+
+	/* The seed comes from the time, make sure it's a different one */
+	sleep(1);
+	run_fixture(env, "-f", out, sizeof(out));
+	assert_not_null(strstr(out, FROM_SNAPSHOT));
+	assert_not_null(strstr(out, NEXT_OK));
+
+	/* Header intact, arena gone */
+	assert_int_eq(truncate(path, sysconf(_SC_PAGESIZE)), 0);
+	run_fixture(env, "-f", out, sizeof(out));
+	assert_null(strstr(out, FROM_SNAPSHOT));
+	assert_not_null(strstr(out, NEXT_OK));
+}
@@ -0,0 +1,32 @@
+#include <stdio.h>
+
+struct TestEnv {
+	/* scratch directory, with the runner linked in as check and the fixture
+	 * suite's tests under fixture/ */
+	char root[32];
+};
+
+/* What the nested runner prints for fixture tests */
+#define CRASH_FAIL " test " T_ITAL "crash" T_NORM "... " T_RED T_BOLD "FAIL"
+#define NEXT_OK " test " T_ITAL "next" T_NORM "... " T_GREEN T_BOLD "OK"
+#define NEXT_SKIPPED \
+	" test " T_ITAL "next" T_NORM "... " T_DIM "unchanged, skipping"
+#define BUDGET_FAIL " test " T_ITAL "budget" T_NORM "... " T_RED T_BOLD "FAIL"
+
+/* Run the fixture suite under a nested runner, return all it printed */
+static void
+run_fixture(struct TestEnv *env, const char *opts, char *out, size_t size)
+{
+	char cmd[128];
+	size_t len;
+	FILE *p;
+	int ret;
+
+	sprintf(cmd, "%s/check %s fixture 2>&1", env->root, opts);
+	p = popen(cmd, "r");
+	assert_not_null(p);
+	len = fread(out, 1, size - 1, p);
+	out[len] = '\0';
+	ret = pclose(p);
+	assert_int_neq(ret, -1);
+}
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../check.h"
+#include "compact.h"
+#include "table.h"
+#include "testenv.h"
+
+/* Every key is found with its value, values can be changed, and keys that
+ * only share a prefix with one in the table aren't found */
+void
+test(struct TestEnv *env)
+{
+	const size_t width = 32;
+	char buf[width + 1];
+	struct CompactTable c;
+	void **val;
+
+	assert_int_eq(table_compact(&env->tbl, &c), 0);
+	assert_ulong_eq(c.n, env->tbl.n_filled);
+	for (unsigned i = 0; i < env->N; i++) {
+		val = compact_find(&c, env->keys[i]);
+		assert_not_null(val);
+		assert_ptr_eq(*val, *table_find(&env->tbl, env->keys[i]));
+	}
+
+	for (unsigned i = 0; i < env->N / 10; i++) {
+		const char *key = env->keys[random_ulong() % env->N];
+		const size_t len = strlen(key);
+
+		/* Shorter, longer, and the same but for the last byte */
+		memcpy(buf, key, len + 1);
+		buf[len - 1] = '\0';
+		assert_null(compact_find(&c, buf));
+		buf[len - 1] = key[len - 1];
+		buf[len] = '!';
+		buf[len + 1] = '\0';
+		assert_null(compact_find(&c, buf));
+		buf[len] = '\0';
+		buf[len - 1] = (char)(key[len - 1] == '!' ? '"' : '!');
+		assert_null(compact_find(&c, buf));
+
+		val = compact_find(&c, key);
+		assert_not_null(val);
+		*val = buf;
+		assert_ptr_eq(*compact_find(&c, key), buf);
+	}
+
+	compact_destroy(&c);
+
+	/* Keys sharing long prefixes, so blocks actually get front coded. Odd
+	 * files are left out, and have neighbours on both sides. */
+	{
+		struct Table paths;
+
+		assert_int_eq(table_init(&paths), 0);
+		for (unsigned i = 0; i < 4000; i += 2) {
+			snprintf(buf, sizeof(buf), "/usr/d%u/s%u/f%u", i / 400, i / 20, i);
+			assert_int_eq(
+				table_insert(&paths, buf, (void *)(uintptr_t)(i + 1)),
+				0
+			);
+		}
+		assert_int_eq(table_compact(&paths, &c), 0);
+		assert_ulong(c.keys_len, <, 2000UL * 8);
+		for (unsigned i = 0; i < 4000; i++) {
+			snprintf(buf, sizeof(buf), "/usr/d%u/s%u/f%u", i / 400, i / 20, i);
+			val = compact_find(&c, buf);
+			if (i % 2) {
+				assert_null(val);
+			} else {
+				assert_not_null(val);
+				assert_ulong_eq((unsigned long)(uintptr_t)*val, i + 1UL);
+			}
+		}
+		compact_destroy(&c);
+		table_destroy(&paths);
+	}
+}
@@ -0,0 +1,65 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../check.h"
+#include "table.h"
+#include "testenv.h"
+
+/* The filter never hides a key, and keeps up with deletes and resizes */
+void
+test(struct TestEnv *env)
+{
+	const size_t width = 32;
+	char buf[width];
+	unsigned passed = 0, misses = 0;
+	bool *deleted;
+
+	deleted = calloc(env->N, sizeof(*deleted));
+	assert_not_null(deleted);
+	assert_int_eq(table_filter(&env->tbl, 8), 0);
+
+	for (unsigned i = 0; i < env->N; i++)
+		assert_not_null(table_find(&env->tbl, env->keys[i]));
+
+	/* Random strings of a different length can't be keys */
+	for (unsigned i = 0; i < env->N / 10; i++) {
+		random_string(buf, width - 1);
+		assert_null(table_find(&env->tbl, buf));
+		passed += (unsigned)table_filter_pass(&env->tbl, buf);
+		misses++;
+	}
+	/* About 0.6% at this load, leave room for bad luck */
+	assert_uint(passed, <, misses / 50);
+
+	for (unsigned i = 0; i < env->N / 3; i++) {
+		unsigned long x = random_ulong() % env->N;
+
+		if (!deleted[x])
+			assert_int_eq(table_delete(&env->tbl, env->keys[x]), 0);
+		deleted[x] = 1;
+	}
+	for (unsigned i = 0; i < env->N; i++) {
+		if (deleted[i])
+			assert_null(table_find(&env->tbl, env->keys[i]));
+		else
+			assert_not_null(table_find(&env->tbl, env->keys[i]));
+	}
+
+	/* Put them back, past the next resize */
+	for (unsigned i = 0; i < env->N; i++)
+		if (deleted[i])
+			assert_int_eq(table_insert(&env->tbl, env->keys[i], NULL), 0);
+	for (unsigned i = 0; i < env->N / 2; i++) {
+		char *key = arena_alloc(width);
+
+		assert_not_null(key);
+		random_string(key, width - 2);
+		assert_int_eq(table_insert(&env->tbl, key, key), 0);
+		assert_ptr_eq(*table_find(&env->tbl, key), key);
+	}
+	for (unsigned i = 0; i < env->N; i++)
+		assert_not_null(table_find(&env->tbl, env->keys[i]));
+
+	free(deleted);
+}
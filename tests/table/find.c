@@ -4,6 +4,9 @@
 #include "table.h"
 #include "testenv.h"
 
+TEST_INPROCESS_SAFE;
+CHECK_ALLOC_BUDGET(0); /* lookups never allocate */
+
 /* Test whether the initial insert was correct */
 void
 test(struct TestEnv *env)
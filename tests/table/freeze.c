@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../check.h"
+#include "frozen.h"
+#include "table.h"
+#include "testenv.h"
+
+static void
+check_frozen(struct TestEnv *env, const struct FrozenTable *f)
+{
+	const size_t width = 32;
+	char buf[width];
+
+	assert_ulong_eq(f->n, env->tbl.n_filled);
+	for (unsigned i = 0; i < env->N; i++) {
+		void *val;
+
+		assert_int_eq(frozen_find(f, env->keys[i], &val), 0);
+		assert_ptr_eq(val, *table_find(&env->tbl, env->keys[i]));
+	}
+	/* Random strings of a different length can't be keys */
+	for (unsigned i = 0; i < env->N / 10; i++) {
+		void *val;
+
+		random_string(buf, width - 1);
+		assert_int_eq(frozen_find(f, buf, &val), -1);
+	}
+}
+
+/* Every key is found with its value, in memory and after a round trip
+ * through a file */
+void
+test(struct TestEnv *env)
+{
+	struct FrozenTable f, g;
+	char path[] = "/tmp/check-frozen-XXXXXX";
+	int fd;
+
+	assert_int_eq(table_freeze(&env->tbl, &f), 0);
+	/* Everything but the key text fits in the Table's slots and then some */
+	assert_ulong(f.map_len - f.keys_len, <, env->tbl.n_slots * 8);
+	check_frozen(env, &f);
+
+	fd = mkstemp(path);
+	assert_int_neq(fd, -1);
+	close(fd);
+	assert_int_eq(frozen_write(&f, path), 0);
+	assert_int_eq(frozen_load(&g, path), 0);
+	assert_int_eq(unlink(path), 0);
+	assert_ulong_eq(g.map_len, f.map_len);
+	assert_int_eq(memcmp(g.map, f.map, f.map_len), 0);
+	check_frozen(env, &g);
+	frozen_destroy(&g);
+
+	/* A truncated file is turned away */
+	assert_int_eq(frozen_write(&f, path), 0);
+	assert_int_eq(truncate(path, (off_t)(f.map_len - 1)), 0);
+	assert_int_eq(frozen_load(&g, path), -1);
+	assert_int_eq(unlink(path), 0);
+
+	frozen_destroy(&f);
+
+	/* An empty table freezes, and survives a round trip */
+	{
+		struct Table empty;
+		void *val;
+
+		assert_int_eq(table_init(&empty), 0);
+		assert_int_eq(table_freeze(&empty, &f), 0);
+		assert_ulong_eq(f.n, 0UL);
+		assert_int_eq(frozen_find(&f, "key", &val), -1);
+		assert_int_eq(frozen_write(&f, path), 0);
+		assert_int_eq(frozen_load(&g, path), 0);
+		assert_int_eq(unlink(path), 0);
+		assert_int_eq(frozen_find(&g, "key", &val), -1);
+		frozen_destroy(&g);
+		frozen_destroy(&f);
+		table_destroy(&empty);
+	}
+}
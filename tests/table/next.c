@@ -0,0 +1,28 @@
+#include "../check.h"
+#include "table.h"
+#include "testenv.h"
+
+/* Test whether iteration sees every entry once, stepping over tombstones */
+void
+test(struct TestEnv *env)
+{
+	size_t pos, n;
+	const char *key;
+	void *val;
+
+	for (unsigned int i = 0; i < env->N / 3; i++)
+		table_delete(&env->tbl, env->keys[random_ulong() % env->N]);
+	assert_ulong(env->tbl.n_tomb, >, 0L);
+
+	pos = n = 0;
+	while (table_next(&env->tbl, &pos, &key, &val)) {
+		void **res;
+
+		res = table_find(&env->tbl, key);
+		assert_not_null(res);
+		assert_ptr(*res, ==, val);
+		n++;
+	}
+	assert_ulong_eq(n, env->tbl.n_filled);
+	assert_int_eq(table_next(&env->tbl, &pos, &key, &val), 0);
+}
@@ -5,6 +5,37 @@
 #include "table.h"
 #include "testenv.h"
 
+SETUP_SNAPSHOT;
+
+static unsigned long
+key_prod(const char *key)
+{
+	unsigned long x = 1;
+
+	for (; *key; key++)
+		x *= (unsigned long)*key;
+	return x;
+}
+
+/* Slot arrays go in the arena with everything else. Arena memory is never
+ * given back, so old arrays stay behind as dead space in the snapshot. */
+static void *
+arena_table_alloc(void *ctx, size_t size)
+{
+	return arena_alloc(size);
+}
+
+static void
+arena_table_free(void *ctx, void *ptr, size_t size)
+{
+}
+
+static const struct TableAlloc arena_table = {
+	arena_table_alloc,
+	arena_table_free,
+	NULL
+};
+
 void
 populate_table(struct TestEnv *env)
 {
@@ -21,39 +52,42 @@ populate_table(struct TestEnv *env)
 			random_string(buf, width);
 		} while (table_find(&env->tbl, buf));
 
-		x = 1;
-		for (size_t j = 0; j < width - 1; j++) {
-			x *= (unsigned long)buf[j];
-		}
-		assert_int_neq(table_insert(&env->tbl, buf, (void *)x), -1);
-
-		env->keys[i] = malloc(width);
+		env->keys[i] = arena_alloc(width);
 		assert_not_null(env->keys[i]);
 		memcpy(env->keys[i], buf, width);
+
+		x = key_prod(buf);
+		assert_int_neq(table_insert(&env->tbl, env->keys[i], (void *)x), -1);
 	}
 }
 
 void
 setup_env(struct TestEnv **env)
 {
-	*env = malloc(sizeof(**env));
-	assert_not_null(env);
+	*env = arena_alloc(sizeof(**env));
+	assert_not_null(*env);
 
 	(*env)->N = 1000000;
 
-	(*env)->keys = malloc((*env)->N * sizeof(*(*env)->keys));
+	(*env)->keys = arena_alloc((*env)->N * sizeof(*(*env)->keys));
 	assert_not_null((*env)->keys);
-	assert_int_neq(table_init(&(*env)->tbl), -1);
-
+	assert_int_neq(table_init_alloc(&(*env)->tbl, &arena_table), -1);
+	/* Keys are in the arena too */
+	(*env)->tbl.borrow_keys = 1;
 
 	populate_table(*env);
 }
 
+/* The whole table comes back with the snapshot, only the allocator's function
+ * pointers may have moved since it was taken. */
+void
+load_env(struct TestEnv *env)
+{
+	env->tbl.alloc = arena_table;
+}
+
 void
 teardown_env(struct TestEnv *env)
 {
-	(void)env;
-	free(env->keys);
 	table_destroy(&env->tbl);
-	free(env);
 }
@@ -0,0 +1,127 @@
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+struct Changes {
+	char seen[16][64];
+	enum TreeChange change[16];
+	unsigned n;
+};
+
+static void
+record_change(enum TreeChange change, const char *path, void *ctx)
+{
+	struct Changes *changes = ctx;
+
+	assert_uint(changes->n, <, 16);
+	strcpy(changes->seen[changes->n], path);
+	changes->change[changes->n++] = change;
+}
+
+static int
+has_change(struct Changes *changes, enum TreeChange change, const char *path)
+{
+	for (unsigned i = 0; i < changes->n; i++)
+		if (changes->change[i] == change && !strcmp(changes->seen[i], path))
+			return 1;
+	return 0;
+}
+
+static void
+write_file(const char *root, const char *name, const char *content)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	int ret;
+
+	sprintf(path, "%s/%s", root, name);
+	f = fopen(path, "w");
+	assert_not_null(f);
+	fputs(content, f);
+	ret = fclose(f);
+	assert_int_eq(ret, 0);
+}
+
+static void
+write_bytes(const char *root, const char *name, const char *buf, size_t len)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	int ret;
+
+	sprintf(path, "%s/%s", root, name);
+	f = fopen(path, "w");
+	assert_not_null(f);
+	assert_ulong_eq(fwrite(buf, 1, len, f), len);
+	ret = fclose(f);
+	assert_int_eq(ret, 0);
+}
+
+/* Diffs should report exactly what changed */
+void
+test(struct TestEnv *env)
+{
+	struct Manifest before, after;
+	struct Changes changes;
+	char root[PATH_MAX / 2], path[PATH_MAX], to[PATH_MAX];
+
+	sprintf(root, "%s/diff", env->root);
+	assert_int_eq(mkdir(root, 0755), 0);
+	sprintf(path, "%s/sub", root);
+	assert_int_eq(mkdir(path, 0755), 0);
+	sprintf(path, "%s/same", root);
+	assert_int_eq(mkdir(path, 0755), 0);
+	write_file(root, "a", "unchanged");
+	write_file(root, "b", "before");
+	write_file(root, "same/x", "unchanged");
+	write_file(root, "sub/c", "removed");
+	write_bytes(root, "bin", "AB\0xyz", 6);
+	assert_int_eq(tree_scan(root, &before), 0);
+
+	write_file(root, "b", "after!");
+	/* Same size, only changed past a NUL */
+	write_bytes(root, "bin", "AB\0qqq", 6);
+	sprintf(path, "%s/sub/c", root);
+	assert_int_eq(unlink(path), 0);
+	write_file(root, "sub/e", "added");
+
+	assert_int_eq(tree_scan(root, &after), 0);
+	memset(&changes, 0, sizeof(changes));
+	assert_int_eq(manifest_diff(&before, &after, record_change, &changes), 0);
+
+	assert_uint_eq(changes.n, 6);
+	assert_int_eq(has_change(&changes, tree_modified, ""), 1);
+	assert_int_eq(has_change(&changes, tree_modified, "b"), 1);
+	assert_int_eq(has_change(&changes, tree_modified, "bin"), 1);
+	assert_int_eq(has_change(&changes, tree_modified, "sub"), 1);
+	assert_int_eq(has_change(&changes, tree_removed, "sub/c"), 1);
+	assert_int_eq(has_change(&changes, tree_added, "sub/e"), 1);
+
+	/* Nothing changed, nothing reported */
+	changes.n = 0;
+	assert_int_eq(manifest_diff(&after, &after, record_change, &changes), 0);
+	assert_uint_eq(changes.n, 0);
+
+	manifest_destroy(&after);
+	manifest_destroy(&before);
+
+	/* A rename to a name with the same 32-bit djb2 hash, and same content */
+	write_file(root, "sub/Ez", "renamed");
+	assert_int_eq(tree_scan(root, &before), 0);
+	sprintf(path, "%s/sub/Ez", root);
+	sprintf(to, "%s/sub/FY", root);
+	assert_int_eq(rename(path, to), 0);
+	assert_int_eq(tree_scan(root, &after), 0);
+	changes.n = 0;
+	assert_int_eq(manifest_diff(&before, &after, record_change, &changes), 0);
+	assert_uint_eq(changes.n, 4);
+	assert_int_eq(has_change(&changes, tree_removed, "sub/Ez"), 1);
+	assert_int_eq(has_change(&changes, tree_added, "sub/FY"), 1);
+	manifest_destroy(&after);
+	manifest_destroy(&before);
+}
@@ -0,0 +1,121 @@
+#include <limits.h>
+#include <string.h>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "../check.h"
+#include "hash.h"
+#include "testenv.h"
+
+/* Many more subdirectories than there are fds to go round */
+static void
+scan_wide(struct TestEnv *env)
+{
+	struct Manifest man;
+	struct rlimit old, low;
+	char path[PATH_MAX];
+	size_t len;
+	int ret;
+
+	sprintf(path, "%s/wide", env->root);
+	assert_int_eq(mkdir(path, 0755), 0);
+	len = strlen(path);
+	for (unsigned i = 0; i < 3000; i++) {
+		sprintf(path + len, "/d%u", i);
+		assert_int_eq(mkdir(path, 0755), 0);
+	}
+	path[len] = '\0';
+
+	assert_int_eq(getrlimit(RLIMIT_NOFILE, &old), 0);
+	low = old;
+	low.rlim_cur = 256;
+	assert_int_eq(setrlimit(RLIMIT_NOFILE, &low), 0);
+	ret = tree_scan(path, &man);
+	assert_int_eq(setrlimit(RLIMIT_NOFILE, &old), 0);
+	assert_int_eq(ret, 0);
+	assert_ulong_eq(man.n_entries, 3001UL);
+	manifest_destroy(&man);
+}
+
+/* Scan the fixture, check every entry, and round-trip it through a file */
+void
+test(struct TestEnv *env)
+{
+	struct Manifest man, loaded, again;
+	char path[PATH_MAX];
+	unsigned n_dirs = 0, n_files = 0, n_links = 0;
+
+	sprintf(path, "%s/fixed", env->root);
+	assert_int_eq(tree_scan(path, &man), 0);
+	assert_ulong_eq(
+		man.n_entries,
+		(unsigned long)(env->n_dirs + env->n_files + env->n_links)
+	);
+
+	for (size_t i = 0; i < man.n_entries; i++) {
+		const struct TreeEntry *ent = man.entries + i;
+		uint64_t hash;
+
+		assert_ptr_eq(manifest_find(&man, manifest_path(&man, ent)), ent);
+		switch (ent->type) {
+		case tree_dir:
+			n_dirs++;
+			break;
+		case tree_file:
+			n_files++;
+			sprintf(path, "%s/fixed/%s", env->root, manifest_path(&man, ent));
+			assert_int_eq(hash_file(path, &hash), 0);
+			assert_ulong_eq((unsigned long)ent->hash, (unsigned long)hash);
+			break;
+		case tree_link:
+			n_links++;
+			break;
+		}
+	}
+	assert_uint_eq(n_dirs, env->n_dirs);
+	assert_uint_eq(n_files, env->n_files);
+	assert_uint_eq(n_links, env->n_links);
+	assert_not_null(manifest_find(&man, "dir0/file0"));
+	assert_null(manifest_find(&man, "nonexistent"));
+
+	sprintf(path, "%s/manifest", env->root);
+	assert_int_eq(manifest_write(&man, path), 0);
+	assert_int_eq(manifest_load(&loaded, path), 0);
+	assert_ulong_eq(loaded.n_entries, man.n_entries);
+	assert_int_eq(
+		memcmp(
+			loaded.entries,
+			man.entries,
+			man.n_entries * sizeof(*man.entries)
+		),
+		0
+	);
+	assert_not_null(manifest_find(&loaded, "dir0/file0"));
+
+	/* A subtree running past the end of its parent's is turned away: dir0's
+	 * first child claims as much as all of dir0 */
+	{
+		const uint32_t n_desc = man.entries[2].n_desc;
+
+		assert_int_eq(strcmp(manifest_path(&man, man.entries + 1), "dir0"), 0);
+		man.entries[2].n_desc = man.entries[1].n_desc;
+		assert_int_eq(manifest_write(&man, path), 0);
+		man.entries[2].n_desc = n_desc;
+		assert_int_eq(manifest_load(&again, path), -1);
+	}
+
+	/* Same tree, same hashes, whatever order the workers got to it */
+	sprintf(path, "%s/fixed", env->root);
+	assert_int_eq(tree_scan(path, &again), 0);
+	assert_ulong_eq(
+		(unsigned long)again.entries[0].hash,
+		(unsigned long)man.entries[0].hash
+	);
+
+	manifest_destroy(&again);
+	manifest_destroy(&loaded);
+	manifest_destroy(&man);
+
+	scan_wide(env);
+}
@@ -0,0 +1,77 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+static void
+make_file(const char *path)
+{
+	char buf[256];
+	size_t len;
+	FILE *f;
+	int ret;
+
+	len = random_uint() % sizeof(buf) + 1;
+	random_string(buf, len);
+	f = fopen(path, "w");
+	assert_not_null(f);
+	fputs(buf, f);
+	ret = fclose(f);
+	assert_int_eq(ret, 0);
+}
+
+/* A few levels of directories with random files in them */
+static void
+make_tree(struct TestEnv *env, char *path, unsigned depth)
+{
+	size_t len = strlen(path);
+	unsigned n;
+
+	assert_int_eq(mkdir(path, 0755), 0);
+	env->n_dirs++;
+
+	n = random_uint() % 8 + 1;
+	for (unsigned i = 0; i < n; i++) {
+		sprintf(path + len, "/file%u", i);
+		make_file(path);
+		env->n_files++;
+	}
+	if (depth) {
+		n = random_uint() % 4 + 1;
+		for (unsigned i = 0; i < n; i++) {
+			sprintf(path + len, "/dir%u", i);
+			make_tree(env, path, depth - 1);
+		}
+	}
+	path[len] = '\0';
+}
+
+void
+setup_env(struct TestEnv **env)
+{
+	char path[PATH_MAX];
+
+	*env = calloc(1, sizeof(**env));
+	assert_not_null(*env);
+	strcpy((*env)->root, "/tmp/check-tree-XXXXXX");
+	assert_not_null(mkdtemp((*env)->root));
+
+	sprintf(path, "%s/fixed", (*env)->root);
+	make_tree(*env, path, 4);
+	strcat(path, "/link");
+	assert_int_eq(symlink("file0", path), 0);
+	(*env)->n_links++;
+}
+
+void
+teardown_env(struct TestEnv *env)
+{
+	remove_tree(AT_FDCWD, env->root);
+	free(env);
+}
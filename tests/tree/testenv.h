@@ -0,0 +1,6 @@
+#include "tree.h"
+
+struct TestEnv {
+	char root[32]; /* scratch directory, fixture tree is under fixed/ */
+	unsigned n_dirs, n_files, n_links;
+};
@@ -0,0 +1,105 @@
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "../check.h"
+#include "hash.h"
+#include "testenv.h"
+
+struct Changes {
+	char path[8][PATH_MAX];
+	int exists[8];
+	unsigned n;
+};
+
+static void
+record_change(const char *path, int exists, void *ctx)
+{
+	struct Changes *changes = ctx;
+
+	assert_uint(changes->n, <, 8);
+	strcpy(changes->path[changes->n], path);
+	changes->exists[changes->n++] = exists;
+}
+
+/* -1 if not reported, else whether it was reported as existing */
+static int
+reported(const struct Changes *changes, const char *path)
+{
+	for (unsigned i = 0; i < changes->n; i++)
+		if (!strcmp(changes->path[i], path))
+			return changes->exists[i];
+	return -1;
+}
+
+static void
+write_file(const char *path, const char *content)
+{
+	FILE *f;
+	int ret;
+
+	f = fopen(path, "w");
+	assert_not_null(f);
+	fputs(content, f);
+	ret = fclose(f);
+	assert_int_eq(ret, 0);
+}
+
+/* Edits, creations and deletions are picked up, and only those */
+void
+test(struct TestEnv *env)
+{
+	struct Watch w;
+	struct Changes changes;
+	char tree[PATH_MAX / 2], a[PATH_MAX], b[PATH_MAX], c[PATH_MAX];
+	char sub[PATH_MAX], d[PATH_MAX];
+	uint64_t token, hash, expected;
+
+	sprintf(tree, "%s/tree", env->root);
+	sprintf(a, "%s/a", tree);
+	sprintf(b, "%s/b", tree);
+	sprintf(c, "%s/c", tree);
+	sprintf(sub, "%s/sub", tree);
+	sprintf(d, "%s/sub/d", tree);
+	write_file(a, "a");
+	write_file(b, "b");
+
+	assert_int_eq(watch_init(&w), 0);
+	assert_int_eq(watch_add_tree(&w, tree), 0);
+	memset(&changes, 0, sizeof(changes));
+	token = watch_changed_since(&w, 0, record_change, &changes);
+	assert_uint_eq(changes.n, 0);
+	assert_int_eq(watch_hash(&w, a, &hash), 0);
+	assert_int_eq(hash_file(a, &expected), 0);
+	assert_ulong_eq((unsigned long)hash, (unsigned long)expected);
+
+	write_file(a, "changed");
+	unlink(b);
+	write_file(c, "new");
+	assert_int_eq(mkdir(sub, 0755), 0);
+	assert_int_eq(watch_process(&w), 0);
+	write_file(d, "in a new directory");
+	assert_int_eq(watch_process(&w), 0);
+
+	token = watch_changed_since(&w, token, record_change, &changes);
+	assert_uint_eq(changes.n, 4);
+	assert_int_eq(reported(&changes, a), 1);
+	assert_int_eq(reported(&changes, b), 0);
+	assert_int_eq(reported(&changes, c), 1);
+	assert_int_eq(reported(&changes, d), 1);
+
+	/* Rehashed lazily */
+	assert_int_eq(watch_hash(&w, a, &hash), 0);
+	assert_int_eq(hash_file(a, &expected), 0);
+	assert_ulong_eq((unsigned long)hash, (unsigned long)expected);
+	assert_int_eq(watch_hash(&w, b, &hash), -1);
+
+	/* Quiet since the last token */
+	changes.n = 0;
+	watch_changed_since(&w, token, record_change, &changes);
+	assert_uint_eq(changes.n, 0);
+
+	watch_destroy(&w);
+}
@@ -0,0 +1,29 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+void
+setup_env(struct TestEnv **env)
+{
+	char path[PATH_MAX];
+
+	*env = calloc(1, sizeof(**env));
+	assert_not_null(*env);
+	strcpy((*env)->root, "/tmp/check-watch-XXXXXX");
+	assert_not_null(mkdtemp((*env)->root));
+	sprintf(path, "%s/tree", (*env)->root);
+	assert_int_eq(mkdir(path, 0755), 0);
+}
+
+void
+teardown_env(struct TestEnv *env)
+{
+	remove_tree(AT_FDCWD, env->root);
+	free(env);
+}
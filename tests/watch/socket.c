@@ -0,0 +1,142 @@
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "../check.h"
+#include "testenv.h"
+
+/* Send a request and pump the watcher until the reply (ending in a "TOKEN"
+ * or single line) is in. */
+static void
+query(struct Watch *w, int fd, const char *req, char *reply, size_t size)
+{
+	size_t len = 0;
+	ssize_t n;
+
+	assert_long_eq((long)write(fd, req, strlen(req)), (long)strlen(req));
+	for (int i = 0; i < 100; i++) {
+		assert_int_eq(watch_poll(w, 10), 0);
+		n = recv(fd, reply + len, size - len - 1, MSG_DONTWAIT);
+		if (n > 0)
+			len += (size_t)n;
+		reply[len] = '\0';
+		if (len && reply[len - 1] == '\n' &&
+		    (strncmp(req, "CHANGED", 7) || strstr(reply, "TOKEN")))
+			return;
+	}
+	assert_quiet(0);
+}
+
+static int
+connect_to(const struct sockaddr_un *addr)
+{
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	assert_int_neq(fd, -1);
+	assert_int_eq(connect(fd, (const struct sockaddr *)addr, sizeof(*addr)), 0);
+	return fd;
+}
+
+/* A client that asks for more than can be buffered and only starts reading
+ * later gets all of it, and doesn't hold up anyone else meanwhile */
+static void
+late_reader(
+	struct Watch *w,
+	const struct sockaddr_un *addr,
+	int fd,
+	const char *tree
+)
+{
+	char path[PATH_MAX], reply[4096];
+	unsigned n_lines = 0, n_tokens = 0;
+	int late, line_start = 1;
+	size_t len;
+	ssize_t n;
+	FILE *f;
+
+	/* Each reply below is far more than the socket and WATCH_OUT_BUF hold */
+	sprintf(path, "%s/late", tree);
+	assert_int_eq(mkdir(path, 0755), 0);
+	len = strlen(path);
+	for (unsigned i = 0; i < 10000; i++) {
+		sprintf(path + len, "/%0100u", i);
+		f = fopen(path, "w");
+		assert_not_null(f);
+		fclose(f);
+	}
+	assert_int_eq(watch_poll(w, 10), 0);
+
+	late = connect_to(addr);
+	assert_long_eq((long)write(late, "CHANGED 0\nCHANGED 0\n", 20), 20L);
+	for (int i = 0; i < 10; i++) {
+		query(w, fd, "TOKEN\n", reply, sizeof(reply));
+		assert_int_eq(strncmp(reply, "TOKEN ", 6), 0);
+	}
+
+	/* Every change, the one before this and the 10000 above, in each */
+	for (int i = 0; i < 100000 && n_tokens < 2; i++) {
+		assert_int_eq(watch_poll(w, 0), 0);
+		n = recv(late, reply, sizeof(reply), MSG_DONTWAIT);
+		assert_long_neq((long)n, 0L);
+		for (ssize_t j = 0; j < n; j++) {
+			if (line_start && reply[j] == 'T')
+				n_tokens++;
+			else if (line_start)
+				n_lines++;
+			line_start = reply[j] == '\n';
+		}
+	}
+	assert_uint_eq(n_tokens, 2);
+	assert_uint_eq(n_lines, 2 * 10001);
+	close(late);
+}
+
+/* The same queries work over the socket */
+void
+test(struct TestEnv *env)
+{
+	struct Watch w;
+	struct sockaddr_un addr;
+	char tree[PATH_MAX / 2], path[PATH_MAX], reply[4096], req[PATH_MAX + 8];
+	int fd;
+	FILE *f;
+
+	sprintf(tree, "%s/tree", env->root);
+	assert_int_eq(watch_init(&w), 0);
+	assert_int_eq(watch_add_tree(&w, tree), 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	sprintf(addr.sun_path, "%s/sock", env->root);
+	assert_int_eq(watch_listen(&w, addr.sun_path), 0);
+
+	fd = connect_to(&addr);
+
+	query(&w, fd, "TOKEN\n", reply, sizeof(reply));
+	assert_int_eq(strcmp(reply, "TOKEN 0\n"), 0);
+
+	sprintf(path, "%s/socket-file", tree);
+	f = fopen(path, "w");
+	assert_not_null(f);
+	fclose(f);
+
+	query(&w, fd, "CHANGED 0\n", reply, sizeof(reply));
+	sprintf(req, "M %s\n", path);
+	assert_not_null(strstr(reply, req));
+
+	sprintf(req, "HASH %s\n", path);
+	query(&w, fd, req, reply, sizeof(reply));
+	assert_ulong_eq((unsigned long)strlen(reply), 17UL);
+
+	query(&w, fd, "HASH /nonexistent\n", reply, sizeof(reply));
+	assert_int_eq(strcmp(reply, "ERR\n"), 0);
+
+	late_reader(&w, &addr, fd, tree);
+
+	close(fd);
+	watch_destroy(&w);
+}
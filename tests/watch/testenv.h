@@ -0,0 +1,5 @@
+#include "watch.h"
+
+struct TestEnv {
+	char root[32]; /* scratch directory, watched tree is under tree/ */
+};